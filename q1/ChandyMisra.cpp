@@ -0,0 +1,315 @@
+#ifndef ChandyMisra_CPP
+#define ChandyMisra_CPP
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include "ResourceGraph.cpp"
+
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+
+/**
+ * Chandy-Misra hygienic forks. Every resource shared by two agents (a fork
+ * between two philosophers) is an edge of the conflict graph, and the whole
+ * conversation between the two neighbours about that fork happens through a
+ * single atomic word on the edge (the mailbox):
+ *
+ *   owner     philosopher currently holding the fork
+ *   DIRTY     fork has been eaten with since it was last handed over
+ *   REQUESTED the non owner holds the request token, he wants the fork
+ *   IN_USE    the owner is eating with it
+ *
+ * A fork is only ever given up dirty and always arrives clean, so a hungry
+ * philosopher keeps what his neighbour just handed him and the precedence graph
+ * stays acyclic (no deadlock, no starvation). Since the owner may be asleep
+ * thinking, a hungry neighbour takes a dirty fork that is not in use himself
+ * with a CAS rather than waiting to be served. Waiting for a clean fork parks
+ * on the edge word with a futex, the owner wakes him when he hands it over.
+ * There is no lock shared by more than two philosophers
+ */
+#define EDGE_DIRTY 1u
+#define EDGE_REQUESTED 2u
+#define EDGE_IN_USE 4u
+#define EDGE_OWNER_SHIFT 3
+
+struct alignas(CACHE_LINE) HygienicEdge
+{
+    std::atomic<uint32_t> word;
+    unsigned int users[2];
+};
+
+class HygienicTable
+{
+private:
+    HygienicEdge *edges;
+    unsigned int forkCount;
+    const StopToken *stop;
+
+    static uint32_t owner_of(uint32_t word) { return word >> EDGE_OWNER_SHIFT; }
+    static uint32_t make_word(uint32_t owner, uint32_t flags) { return (owner << EDGE_OWNER_SHIFT) | flags; }
+    unsigned int neighbour(unsigned int fork, unsigned int philosopher);
+    bool take_or_request(unsigned int fork, unsigned int philosopher);
+    bool mark_in_use(unsigned int fork, unsigned int philosopher);
+    void put_down(unsigned int fork, unsigned int philosopher);
+    void unpin(unsigned int fork, unsigned int philosopher);
+    void wait_for_change(unsigned int fork, uint32_t seen);
+    void wake(unsigned int fork);
+
+public:
+    HygienicTable(ResourceGraph &graph, const StopToken *_stop);
+    ~HygienicTable();
+    static bool supports(ResourceGraph&);
+    bool pickup(unsigned int philosopher, const unsigned int *ids, unsigned int count);
+    void putdown(unsigned int philosopher, const unsigned int *ids, unsigned int count);
+    void wake_all();
+};
+
+/**
+ * @brief Chandy-Misra only has two parties per fork, so every resource in the
+ * graph must have capacity 1 and at most two agents needing it
+ */
+bool HygienicTable::supports(ResourceGraph &graph)
+{
+    for(unsigned int resource = 0; resource < graph.resource_count(); resource++)
+    {
+        if(graph.capacity_of(resource) != 1 || graph.users_of(resource).size() > 2)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief One edge per resource between the (at most) two agents needing it.
+ * Forks start dirty with the lower numbered of their two users, which orders
+ * the precedence graph by index and so makes it acyclic
+ */
+HygienicTable::HygienicTable(ResourceGraph &graph, const StopToken *_stop)
+{
+    this->forkCount = graph.resource_count();
+    this->stop = _stop;
+    edges = new HygienicEdge[forkCount];
+
+    for(unsigned int fork = 0; fork < forkCount; fork++)
+    {
+        HygienicEdge &edge = edges[fork];
+        vector<unsigned int> users = graph.users_of(fork);
+        edge.users[0] = users.empty() ? 0 : users[0];
+        // Nobody to pass it to if only one agent needs it
+        edge.users[1] = users.size() < 2 ? edge.users[0] : users[1];
+        unsigned int lower = edge.users[0] < edge.users[1] ? edge.users[0] : edge.users[1];
+        edge.word.store(make_word(lower, EDGE_DIRTY));
+    }
+}
+
+HygienicTable::~HygienicTable()
+{
+    delete[] edges;
+}
+
+unsigned int HygienicTable::neighbour(unsigned int fork, unsigned int philosopher)
+{
+    HygienicEdge &edge = edges[fork];
+    return edge.users[0] == philosopher ? edge.users[1] : edge.users[0];
+}
+
+/**
+ * @brief Parks until the edge word changes. The hand over wakes the waiter,
+ * the timeout only bounds how late he notices the table closing if the stop
+ * lands between his check and the futex call
+ */
+void HygienicTable::wait_for_change(unsigned int fork, uint32_t seen)
+{
+    struct timespec timeout = {STOP_CHECK_MSEC/1000, (STOP_CHECK_MSEC%1000)*1000000l};
+    syscall(SYS_futex, (uint32_t*)&edges[fork].word, FUTEX_WAIT_PRIVATE, seen, &timeout, NULL, 0);
+}
+
+void HygienicTable::wake(unsigned int fork)
+{
+    syscall(SYS_futex, (uint32_t*)&edges[fork].word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+/**
+ * @brief Makes sure philosopher owns fork: takes it if the neighbour left it
+ * dirty and is not eating with it, otherwise leaves the request token on the
+ * edge
+ *
+ * @return true if philosopher owns the fork
+ */
+bool HygienicTable::take_or_request(unsigned int fork, unsigned int philosopher)
+{
+    std::atomic<uint32_t> &word = edges[fork].word;
+    uint32_t seen = word.load(std::memory_order_acquire);
+    while(true)
+    {
+        if(owner_of(seen) == philosopher)
+        {
+            return true;
+        }
+        uint32_t desired;
+        if((seen & EDGE_DIRTY) && !(seen & EDGE_IN_USE))
+        {
+            // Cleaned on the way over
+            desired = make_word(philosopher, 0);
+        }
+        else if(!(seen & EDGE_REQUESTED))
+        {
+            desired = seen | EDGE_REQUESTED;
+        }
+        else
+        {
+            return false;
+        }
+        if(word.compare_exchange_weak(seen, desired, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            return owner_of(desired) == philosopher;
+        }
+    }
+}
+
+/**
+ * @brief Pins an owned fork for eating. Fails if the neighbour has taken it
+ * in the meantime
+ */
+bool HygienicTable::mark_in_use(unsigned int fork, unsigned int philosopher)
+{
+    std::atomic<uint32_t> &word = edges[fork].word;
+    uint32_t seen = word.load(std::memory_order_acquire);
+    while(owner_of(seen) == philosopher)
+    {
+        if(word.compare_exchange_weak(seen, seen | EDGE_IN_USE, std::memory_order_acq_rel, std::memory_order_acquire))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Unpins a fork, it is dirty from here on. If the neighbour left his
+ * request token it is handed straight to him, clean
+ */
+void HygienicTable::put_down(unsigned int fork, unsigned int philosopher)
+{
+    std::atomic<uint32_t> &word = edges[fork].word;
+    uint32_t seen = word.load(std::memory_order_acquire);
+    uint32_t desired;
+    do
+    {
+        if(seen & EDGE_REQUESTED)
+        {
+            desired = make_word(neighbour(fork, philosopher), 0);
+        }
+        else
+        {
+            desired = make_word(philosopher, EDGE_DIRTY);
+        }
+    } while(!word.compare_exchange_weak(seen, desired, std::memory_order_acq_rel, std::memory_order_acquire));
+
+    if(seen & EDGE_REQUESTED)
+    {
+        wake(fork);
+    }
+}
+
+/**
+ * @brief Undoes mark_in_use when the other fork could not be pinned. A clean
+ * fork stays with the philosopher, a dirty one goes to a neighbour asking for
+ * it
+ */
+void HygienicTable::unpin(unsigned int fork, unsigned int philosopher)
+{
+    std::atomic<uint32_t> &word = edges[fork].word;
+    uint32_t seen = word.load(std::memory_order_acquire);
+    uint32_t desired;
+    do
+    {
+        if((seen & EDGE_REQUESTED) && (seen & EDGE_DIRTY))
+        {
+            desired = make_word(neighbour(fork, philosopher), 0);
+        }
+        else
+        {
+            desired = seen & ~EDGE_IN_USE;
+        }
+    } while(!word.compare_exchange_weak(seen, desired, std::memory_order_acq_rel, std::memory_order_acquire));
+
+    if(owner_of(desired) != philosopher)
+    {
+        wake(fork);
+    }
+}
+
+/**
+ * @brief Blocks until philosopher holds every fork in ids and has pinned them
+ * for eating, or the table is closing
+ *
+ * @return true if the philosopher can eat
+ */
+bool HygienicTable::pickup(unsigned int philosopher, const unsigned int *ids, unsigned int count)
+{
+    while(!stop->stop_requested())
+    {
+        unsigned int missing = count;
+        for(unsigned int i = 0; i < count; i++)
+        {
+            if(!take_or_request(ids[i], philosopher) && missing == count)
+            {
+                missing = i;
+            }
+        }
+
+        if(missing == count)
+        {
+            unsigned int pinned = 0;
+            while(pinned < count && mark_in_use(ids[pinned], philosopher))
+            {
+                pinned++;
+            }
+            if(pinned == count)
+            {
+                return true;
+            }
+            while(pinned > 0)
+            {
+                unpin(ids[--pinned], philosopher);
+            }
+            continue;
+        }
+
+        uint32_t seen = edges[ids[missing]].word.load(std::memory_order_acquire);
+        if(owner_of(seen) != philosopher)
+        {
+            wait_for_change(ids[missing], seen);
+        }
+    }
+    return false;
+}
+
+void HygienicTable::putdown(unsigned int philosopher, const unsigned int *ids, unsigned int count)
+{
+    for(unsigned int i = 0; i < count; i++)
+    {
+        put_down(ids[i], philosopher);
+    }
+}
+
+/**
+ * @brief Wakes every parked philosopher so they see the stop right away
+ */
+void HygienicTable::wake_all()
+{
+    for(unsigned int fork = 0; fork < forkCount; fork++)
+    {
+        syscall(SYS_futex, (uint32_t*)&edges[fork].word, FUTEX_WAKE_PRIVATE, 2, NULL, NULL, 0);
+    }
+}
+
+#endif
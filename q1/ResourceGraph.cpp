@@ -0,0 +1,373 @@
+#ifndef ResourceGraph_CPP
+#define ResourceGraph_CPP
+
+#include <vector>
+#include <algorithm>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "StopToken.cpp"
+
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+
+// Bounds on what a topology file may ask for
+#define TOPOLOGY_MAX_RESOURCES (1u << 20)
+#define TOPOLOGY_MAX_CAPACITY (1u << 16)
+
+using std::vector;
+
+/**
+ * @brief A shared resource (a fork on the classic table). capacity agents can
+ * hold it at once, a plain fork has capacity 1. Padded so neighbouring
+ * resources never share a cache line
+ */
+struct alignas(CACHE_LINE) Resource
+{
+    sem_t available;
+    unsigned int capacity;
+};
+
+/**
+ * @brief One agent's resources in ascending index order. Only the graph builds
+ * them, once per agent as it is added, so every batch handed to acquire_all is
+ * sorted and all agents take contended resources in the same global order
+ */
+class ResourceBatch
+{
+private:
+    friend class ResourceGraph;
+    vector<unsigned int> ids;
+    ResourceBatch(const vector<unsigned int> &_ids) : ids(_ids) { std::sort(ids.begin(), ids.end()); }
+
+public:
+    const unsigned int* data() const { return ids.data(); }
+    unsigned int size() const { return ids.size(); }
+};
+
+/**
+ * Which agent needs which resources. Either the classic ring (agent n needs
+ * forks n and n+1) or loaded from a topology file:
+ *
+ *   # comment
+ *   resources <count>
+ *   capacity <resource> <capacity>     (optional, defaults to 1)
+ *   agent <resource> <resource> ...    (one line per agent, in agent order)
+ *
+ * Every agent needs all of its resources at once to eat
+ */
+class ResourceGraph
+{
+private:
+    Resource *resources;
+    unsigned int resourceCount;
+    vector< vector<unsigned int> > needs;
+    vector<ResourceBatch> batches;
+    bool add_agent(const vector<unsigned int>&);
+    bool wait_for_each(const unsigned int *ids, unsigned int count, const StopToken &stop);
+    static bool parse_number(const char *token, unsigned int low, unsigned int high, unsigned int *value);
+
+public:
+    ResourceGraph();
+    ~ResourceGraph();
+    void build_ring(unsigned int agentCount);
+    int load(const char *path);
+    int init_resources();
+    unsigned int agent_count() { return needs.size(); }
+    unsigned int resource_count() { return resourceCount; }
+    unsigned int capacity_of(unsigned int resource) { return resources[resource].capacity; }
+    const vector<unsigned int>& needs_of(unsigned int agent) { return needs[agent]; }
+    const ResourceBatch& batch_of(unsigned int agent) { return batches[agent]; }
+    vector<unsigned int> users_of(unsigned int resource);
+    bool acquire_all(const ResourceBatch &batch, const StopToken &stop);
+    bool acquire_in_listed_order(unsigned int agent, const StopToken &stop);
+    bool try_acquire_all(const unsigned int *ids, unsigned int count);
+    void release_all(const unsigned int *ids, unsigned int count);
+};
+
+ResourceGraph::ResourceGraph() : resources(NULL), resourceCount(0)
+{
+}
+
+ResourceGraph::~ResourceGraph()
+{
+    if(resources != NULL)
+    {
+        for(unsigned int i = 0; i < resourceCount; i++)
+        {
+            sem_destroy(&resources[i].available);
+        }
+        delete[] resources;
+    }
+}
+
+/**
+ * @brief Records an agent's needs, a resource listed twice is only needed once
+ *
+ * @return false if a resource is out of range
+ */
+bool ResourceGraph::add_agent(const vector<unsigned int> &agentNeeds)
+{
+    vector<unsigned int> unique;
+    for(long unsigned int i = 0; i < agentNeeds.size(); i++)
+    {
+        if(agentNeeds[i] >= resourceCount)
+        {
+            return false;
+        }
+        if(find(unique.begin(), unique.end(), agentNeeds[i]) == unique.end())
+        {
+            unique.push_back(agentNeeds[i]);
+        }
+    }
+    needs.push_back(unique);
+    batches.push_back(ResourceBatch(unique));
+    return true;
+}
+
+/**
+ * @brief The classic table, one fork between every two neighbours so there
+ * are as many forks as agents. Other shapes come from a topology file
+ */
+void ResourceGraph::build_ring(unsigned int agentCount)
+{
+    resourceCount = agentCount;
+    resources = new Resource[resourceCount];
+    for(unsigned int i = 0; i < resourceCount; i++)
+    {
+        resources[i].capacity = 1;
+    }
+    for(unsigned int agent = 0; agent < agentCount; agent++)
+    {
+        vector<unsigned int> forks;
+        forks.push_back(agent);
+        forks.push_back((agent+1)%resourceCount);
+        add_agent(forks);
+    }
+}
+
+/**
+ * @brief Reads token as a whole number in [low, high]
+ *
+ * @return false if token is missing, not entirely a number or out of range
+ */
+bool ResourceGraph::parse_number(const char *token, unsigned int low, unsigned int high, unsigned int *value)
+{
+    if(token == NULL)
+    {
+        return false;
+    }
+    char *end;
+    long number = strtol(token, &end, 10);
+    if(end == token || *end != '\0' || number < (long)low || number > (long)high)
+    {
+        return false;
+    }
+    *value = number;
+    return true;
+}
+
+int ResourceGraph::load(const char *path)
+{
+    FILE *in = fopen(path, "r");
+    if(in == NULL)
+    {
+        printf("Failed to open topology %s\n", path);
+        return -1;
+    }
+
+    char line[4096];
+    unsigned int lineNumber = 0;
+    while(fgets(line, sizeof(line), in) != NULL)
+    {
+        lineNumber++;
+        char *token = strtok(line, " \t\r\n");
+        if(token == NULL || token[0] == '#')
+        {
+            continue;
+        }
+
+        bool valid = true;
+        try
+        {
+            if(strcmp(token, "resources") == 0 && resources == NULL)
+            {
+                unsigned int count;
+                valid = parse_number(strtok(NULL, " \t\r\n"), 1, TOPOLOGY_MAX_RESOURCES, &count);
+                if(valid)
+                {
+                    resources = new Resource[count];
+                    resourceCount = count;
+                    for(unsigned int i = 0; i < resourceCount; i++)
+                    {
+                        resources[i].capacity = 1;
+                    }
+                }
+            }
+            else if(strcmp(token, "capacity") == 0 && resources != NULL)
+            {
+                unsigned int resource, capacity;
+                valid = parse_number(strtok(NULL, " \t\r\n"), 0, resourceCount-1, &resource) &&
+                        parse_number(strtok(NULL, " \t\r\n"), 1, TOPOLOGY_MAX_CAPACITY, &capacity);
+                if(valid)
+                {
+                    resources[resource].capacity = capacity;
+                }
+            }
+            else if(strcmp(token, "agent") == 0 && resources != NULL)
+            {
+                vector<unsigned int> agentNeeds;
+                unsigned int resource;
+                while(valid && (token = strtok(NULL, " \t\r\n")) != NULL && token[0] != '#')
+                {
+                    valid = parse_number(token, 0, resourceCount-1, &resource);
+                    agentNeeds.push_back(resource);
+                }
+                valid = valid && !agentNeeds.empty() && add_agent(agentNeeds);
+            }
+            else
+            {
+                valid = false;
+            }
+        }
+        catch (const std::bad_alloc &e)
+        {
+            printf("Failed to allocate topology %s, ERROR %s\n", path, e.what());
+            valid = false;
+        }
+
+        if(!valid)
+        {
+            printf("Invalid topology %s at line %u\n", path, lineNumber);
+            fclose(in);
+            return -1;
+        }
+    }
+    fclose(in);
+
+    if(needs.empty())
+    {
+        printf("Topology %s has no agents\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int ResourceGraph::init_resources()
+{
+    for(unsigned int i = 0; i < resourceCount; i++)
+    {
+        if(sem_init(&resources[i].available, 0, resources[i].capacity))
+        {
+            printf("Failed to initialize resource[%d]\n", i);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+vector<unsigned int> ResourceGraph::users_of(unsigned int resource)
+{
+    vector<unsigned int> users;
+    for(unsigned int agent = 0; agent < needs.size(); agent++)
+    {
+        if(find(needs[agent].begin(), needs[agent].end(), resource) != needs[agent].end())
+        {
+            users.push_back(agent);
+        }
+    }
+    return users;
+}
+
+/**
+ * @brief Blocks until every resource in the batch is held or the stop is
+ * requested. Deadlock free by construction: a batch is always sorted, so no
+ * two callers can each hold what the other waits for (no circular wait)
+ *
+ * @return true if every resource is held, false (holding none) if stopped
+ */
+bool ResourceGraph::acquire_all(const ResourceBatch &batch, const StopToken &stop)
+{
+    return wait_for_each(batch.data(), batch.size(), stop);
+}
+
+/**
+ * @brief Blocks on the agent's resources in the order its needs list them,
+ * left then right on the ring. Deadlock prone on purpose, this is the
+ * classic unordered dining philosophers demo and only the stop gets a stuck
+ * table out
+ *
+ * @return true if every resource is held, false (holding none) if stopped
+ */
+bool ResourceGraph::acquire_in_listed_order(unsigned int agent, const StopToken &stop)
+{
+    return wait_for_each(needs[agent].data(), needs[agent].size(), stop);
+}
+
+/**
+ * @brief Takes the resources one after the other in the order given. A
+ * contended resource is waited on in slices of STOP_CHECK_MSEC, a holder
+ * posting it still wakes the waiter immediately
+ */
+bool ResourceGraph::wait_for_each(const unsigned int *ids, unsigned int count, const StopToken &stop)
+{
+    for(unsigned int i = 0; i < count; i++)
+    {
+        sem_t *available = &resources[ids[i]].available;
+        if(sem_trywait(available) == 0)
+        {
+            continue;
+        }
+        while(true)
+        {
+            struct timespec deadline;
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            deadline.tv_nsec += STOP_CHECK_MSEC*1000000l;
+            deadline.tv_sec += deadline.tv_nsec/1000000000l;
+            deadline.tv_nsec %= 1000000000l;
+            if(sem_clockwait(available, CLOCK_MONOTONIC, &deadline) == 0)
+            {
+                break;
+            }
+            if(stop.stop_requested())
+            {
+                release_all(ids, i);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief All or nothing, takes every resource in ids if all are available
+ * right now, otherwise gives back what it took. Never blocks so it can't
+ * deadlock whatever the order
+ *
+ * @return true if every resource is held
+ */
+bool ResourceGraph::try_acquire_all(const unsigned int *ids, unsigned int count)
+{
+    for(unsigned int i = 0; i < count; i++)
+    {
+        if(sem_trywait(&resources[ids[i]].available) != 0)
+        {
+            release_all(ids, i);
+            return false;
+        }
+    }
+    return true;
+}
+
+void ResourceGraph::release_all(const unsigned int *ids, unsigned int count)
+{
+    for(unsigned int i = count; i > 0; i--)
+    {
+        sem_post(&resources[ids[i-1]].available);
+    }
+}
+
+#endif
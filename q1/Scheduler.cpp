@@ -6,8 +6,8 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <unistd.h>
-
-#define msec 1000
+#include "Trace.cpp"
+#include "StopToken.cpp"
 
 using std::vector;
 using std::swap;
@@ -21,10 +21,12 @@ private:
     unsigned int shuffleResetVal;
     unsigned int shufflePriorityTrigger;
     int philosopherCount;
-    bool* keepRunning;
+    const StopToken* stop;
+    bool closed;
     pthread_mutex_t requestsVectorLock;
     pthread_cond_t *dispatchSignals;
     unsigned int invocationFrequency;
+    unsigned int warmupMsec;
     bool enableDynamicPriorityShuffle;
     bool has_made_an_eat_request(int);
     int find_philosopher_with_priority(int);
@@ -32,29 +34,36 @@ private:
     void release_all_philosophers();
 
 public:
-    Scheduler(int _philosopherCount, bool* _keepRunning, unsigned int _invocationFrequency, int _shuffleResetVal, bool _enableDynamicPriorityShuffle);
+    Scheduler(int _philosopherCount, const StopToken* _stop, unsigned int _invocationFrequency, int _shuffleResetVal, unsigned int _warmupMsec, bool _enableDynamicPriorityShuffle);
     ~Scheduler();
     void run();
-    void make_eat_request(int);
+    bool make_eat_request(int);
     void dispatch(int);
     void arbitrate();
     void shuffle_priorities();
     void update_philosopher_count(int);
 };
 
-Scheduler::Scheduler(int _philosopherCount, bool* _keepRunning, unsigned int _invocationFrequency, int _shuffleResetVal, bool _enableDynamicPriorityShuffle)
+Scheduler::Scheduler(int _philosopherCount, const StopToken* _stop, unsigned int _invocationFrequency, int _shuffleResetVal, unsigned int _warmupMsec, bool _enableDynamicPriorityShuffle)
 {
     
     this->philosopherCount = _philosopherCount;
-    this->keepRunning = _keepRunning;
+    this->stop = _stop;
+    this->closed = false;
     this->invocationFrequency = _invocationFrequency;
+    this->warmupMsec = _warmupMsec;
     this->enableDynamicPriorityShuffle = _enableDynamicPriorityShuffle;
     this->shuffleResetVal = _shuffleResetVal;
+    this->shufflePriorityTrigger = _shuffleResetVal;
         
     pthread_mutex_init(&requestsVectorLock, NULL);
     try
     {
         dispatchSignals = new pthread_cond_t[philosopherCount];
+        for(int i = 0; i < philosopherCount; i++)
+        {
+            pthread_cond_init(&dispatchSignals[i], NULL);
+        }
     }
     catch (const std::bad_alloc &e)
     {
@@ -93,6 +102,7 @@ Scheduler::~Scheduler()
     { 
         pthread_cond_destroy(&dispatchSignals[i]);
     }
+    delete[] dispatchSignals;
 }
 
 bool Scheduler::has_made_an_eat_request(int philosopherIndex)
@@ -100,17 +110,25 @@ bool Scheduler::has_made_an_eat_request(int philosopherIndex)
     return requestsVector[philosopherIndex];
 }
 
-void Scheduler::make_eat_request(int philosopherIndex)
+/**
+ * @brief Blocks until the scheduler dispatches philosopherIndex. Once the
+ * scheduler has closed (checked under the same lock it closes under) nobody
+ * waits anymore, so a request racing with the shutdown can't be left behind
+ *
+ * @return true if granted, false if the scheduler closed instead
+ */
+bool Scheduler::make_eat_request(int philosopherIndex)
 {
     pthread_mutex_lock(&requestsVectorLock);
     requestsVector[philosopherIndex] = true;
-    while(requestsVector[philosopherIndex] == true)
+    while(requestsVector[philosopherIndex] == true && !closed)
     {
-        printf("Philosopher[%d] has made an eat request and is now waiting\n", philosopherIndex);
         pthread_cond_wait(&dispatchSignals[philosopherIndex], &requestsVectorLock);
     }
-    printf("Philosopher[%d] was granted the ability to eat by scheduler\n", philosopherIndex);
+    requestsVector[philosopherIndex] = false;
+    bool granted = !closed;
     pthread_mutex_unlock(&requestsVectorLock);
+    return granted;
 }
 
 void Scheduler::shuffle_priorities()
@@ -124,39 +142,50 @@ void Scheduler::shuffle_priorities()
     
 }
 
+/**
+ * @brief Closes the scheduler and wakes everyone still waiting for a grant.
+ * Done under requestsVectorLock so no request can slip in between the sweep
+ * and the close
+ */
 void Scheduler::release_all_philosophers()
 {
-    printf("Sched is releasing all philosophers\n");
+    TRACE_STATE(TRACE_SCHED_RELEASE_ALL, philosopherCount, 0, TRACE_NO_FORK, 0);
+    pthread_mutex_lock(&requestsVectorLock);
+    closed = true;
     for(int i = 0; i < philosopherCount; i++)
     {
         if(requestsVector[i])
         {
-            printf("Sched is releasing philosopher[%d]\n", i);
+            TRACE_VERBOSE(TRACE_SCHED_DISPATCH, i, 0, TRACE_NO_FORK, 0);
             dispatch(i);
         }
     }
+    pthread_mutex_unlock(&requestsVectorLock);
 }
 
 void Scheduler::run()
 {
-    usleep(1000*500);
-    while(*keepRunning)
+    // The scheduler records into the ring after the philosophers'
+    TRACE_ATTACH(philosopherCount);
+    // Lets requests pile up before the first arbitration
+    if(warmupMsec)
+    {
+        stop->sleep_for(warmupMsec);
+    }
+    while(!stop->stop_requested())
     {
-        printf("Sched about to aquire request lock\n");
         pthread_mutex_lock(&requestsVectorLock);
-        printf("Sched about has acquired request lock\n");
+        TRACE_VERBOSE(TRACE_SCHED_ARBITRATE, philosopherCount, 0, TRACE_NO_FORK, 0);
         arbitrate();
         if(enableDynamicPriorityShuffle && shufflePriorityTrigger == 0)
         {
-            printf("Sched shuffling priorities\n");
+            TRACE_STATE(TRACE_SCHED_SHUFFLE, philosopherCount, 0, TRACE_NO_FORK, 0);
             shuffle_priorities();
             shufflePriorityTrigger = shuffleResetVal;
         }
-        printf("Sched has unlocked requestVector\n");
         pthread_mutex_unlock(&requestsVectorLock);
-        printf("Sched about to sleep\n");
         shufflePriorityTrigger--;
-        usleep(invocationFrequency*msec);
+        stop->sleep_for(invocationFrequency);
     }
     release_all_philosophers();
 }
@@ -184,7 +213,7 @@ void Scheduler::arbitrate()
 
         if(has_made_an_eat_request(philosopherIndex))
         {
-            printf("Sched is allowing philosopher[%d] to eat\n", philosopherIndex);
+            TRACE_VERBOSE(TRACE_SCHED_DISPATCH, philosopherIndex, 0, TRACE_NO_FORK, 0);
             dispatch(philosopherIndex);
         }
     }
@@ -0,0 +1,451 @@
+#ifndef Stats_CPP
+#define Stats_CPP
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef CACHE_LINE
+#define CACHE_LINE 64
+#endif
+
+/**
+ * Log-linear (HDR style) histogram resolution. Values are recorded in
+ * microseconds, every power of two range is split into 2^HIST_SUB_BUCKET_BITS
+ * linear sub buckets, so any reported value is within ~6% of the real one.
+ * HIST_MAX_BIT caps the range at 2^32 usec (a bit over an hour)
+ */
+#define HIST_SUB_BUCKET_BITS 4
+#define HIST_SUB_BUCKETS (1u << HIST_SUB_BUCKET_BITS)
+#define HIST_MAX_BIT 32
+#define HIST_BUCKETS ((HIST_MAX_BIT - HIST_SUB_BUCKET_BITS + 1) * HIST_SUB_BUCKETS)
+#define THROUGHPUT_BIN_MSEC 250
+
+uint64_t now_usec()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec*1000000ull + (uint64_t)now.tv_nsec/1000;
+}
+
+class LatencyHistogram
+{
+private:
+    uint32_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t maxValue;
+    static unsigned int bucket_of(uint64_t);
+    static uint64_t highest_in_bucket(unsigned int);
+
+public:
+    LatencyHistogram();
+    void record(uint64_t);
+    void merge(const LatencyHistogram&);
+    uint64_t percentile(double) const;
+    uint64_t count() const { return total; }
+    uint64_t max() const { return maxValue; }
+};
+
+LatencyHistogram::LatencyHistogram() : total(0), maxValue(0)
+{
+    memset(counts, 0, sizeof(counts));
+}
+
+unsigned int LatencyHistogram::bucket_of(uint64_t value)
+{
+    if(value < 2*HIST_SUB_BUCKETS)
+    {
+        return value;
+    }
+    unsigned int msb = 63 - __builtin_clzll(value);
+    if(msb >= HIST_MAX_BIT)
+    {
+        return HIST_BUCKETS - 1;
+    }
+    unsigned int shift = msb - HIST_SUB_BUCKET_BITS;
+    return (shift+1)*HIST_SUB_BUCKETS + ((value >> shift) - HIST_SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::highest_in_bucket(unsigned int bucket)
+{
+    if(bucket < 2*HIST_SUB_BUCKETS)
+    {
+        return bucket;
+    }
+    unsigned int shift = bucket/HIST_SUB_BUCKETS - 1;
+    uint64_t low = (uint64_t)(bucket%HIST_SUB_BUCKETS + HIST_SUB_BUCKETS) << shift;
+    return low + ((1ull << shift) - 1);
+}
+
+void LatencyHistogram::record(uint64_t value)
+{
+    counts[bucket_of(value)]++;
+    total++;
+    if(value > maxValue)
+    {
+        maxValue = value;
+    }
+}
+
+void LatencyHistogram::merge(const LatencyHistogram &other)
+{
+    for(unsigned int i = 0; i < HIST_BUCKETS; i++)
+    {
+        counts[i] += other.counts[i];
+    }
+    total += other.total;
+    if(other.maxValue > maxValue)
+    {
+        maxValue = other.maxValue;
+    }
+}
+
+/**
+ * @brief Value at or below which p percent of the samples fall, reported as
+ * the top of the bucket it lands in (never above the recorded max)
+ *
+ * @param p percentile in [0, 100]
+ */
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    if(total == 0)
+    {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p/100.0*total + 0.5);
+    if(rank < 1)
+    {
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for(unsigned int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += counts[i];
+        if(seen >= rank)
+        {
+            uint64_t value = highest_in_bucket(i);
+            return value < maxValue ? value : maxValue;
+        }
+    }
+    return maxValue;
+}
+
+/**
+ * @brief Everything a single philosopher measures about itself. Only the
+ * owning thread writes it while the simulation runs, main reads it after the
+ * join. Aligned to a cache line so neighbours never falsely share a counter
+ */
+struct alignas(CACHE_LINE) PhilosopherStats
+{
+    uint64_t eatCount;
+    uint64_t hungrySince;
+    uint64_t schedRequestedAt;
+    uint64_t leftAt;
+    bool hungry;
+    LatencyHistogram hungerToEat;
+    LatencyHistogram schedLatency;
+    uint32_t *eatsPerBin;
+
+    PhilosopherStats() : eatCount(0), hungrySince(0), schedRequestedAt(0), leftAt(0), hungry(false), eatsPerBin(NULL) {}
+};
+
+/**
+ * @brief Whole table figures, latencies in microseconds
+ */
+struct SimSummary
+{
+    uint64_t meals;
+    double eatsPerSec;
+    double fairness;
+    uint64_t starvationP50;
+    uint64_t starvationP99;
+    uint64_t starvationMax;
+    uint64_t schedP50;
+    uint64_t schedP99;
+    uint64_t schedMax;
+    uint64_t shutdownP50;
+    uint64_t shutdownP99;
+    uint64_t shutdownMax;
+    uint64_t shutdownJoin;
+};
+
+class SimStats
+{
+private:
+    PhilosopherStats *philosophers;
+    uint32_t *bins;
+    unsigned int philosopherCount;
+    unsigned int binCount;
+    unsigned int binStride;
+    unsigned int windowMsec;
+    uint64_t startUsec;
+    uint64_t stopUsec;
+    uint64_t joinedUsec;
+    uint64_t since_stop(uint64_t);
+
+public:
+    SimStats();
+    ~SimStats();
+    int init(unsigned int _philosopherCount, unsigned int runTimeMsec);
+    void became_hungry(unsigned int);
+    void sched_requested(unsigned int);
+    void sched_granted(unsigned int);
+    void started_eating(unsigned int);
+    void table_opened();
+    void table_closed();
+    void left_table(unsigned int);
+    void everyone_left();
+    uint64_t eat_count(unsigned int);
+    double jain_fairness();
+    SimSummary summarize();
+    void report();
+};
+
+SimStats::SimStats() : philosophers(NULL), bins(NULL), philosopherCount(0), binCount(0), binStride(0), windowMsec(0), startUsec(0), stopUsec(0), joinedUsec(0)
+{
+}
+
+SimStats::~SimStats()
+{
+    delete[] philosophers;
+    free(bins);
+}
+
+int SimStats::init(unsigned int _philosopherCount, unsigned int runTimeMsec)
+{
+    // One bin per THROUGHPUT_BIN_MSEC of the run plus an open ended overflow
+    // bin for the eats that start late, while everyone is leaving. Each
+    // philosopher's bins start on their own cache line
+    const unsigned int binsPerLine = CACHE_LINE/sizeof(uint32_t);
+    windowMsec = runTimeMsec;
+    binCount = (runTimeMsec + THROUGHPUT_BIN_MSEC - 1)/THROUGHPUT_BIN_MSEC + 1;
+    binStride = (binCount + binsPerLine - 1)/binsPerLine*binsPerLine;
+    size_t binBytes = sizeof(uint32_t)*binStride*_philosopherCount;
+    try
+    {
+        philosophers = new PhilosopherStats[_philosopherCount];
+    }
+    catch (const std::bad_alloc &e)
+    {
+        printf("Failed to allocate philosopher stats, ERROR %s\n", e.what());
+        return -1;
+    }
+    bins = (uint32_t*)aligned_alloc(CACHE_LINE, binBytes);
+    if(bins == NULL)
+    {
+        printf("Failed to allocate throughput bins\n");
+        return -1;
+    }
+    philosopherCount = _philosopherCount;
+    memset(bins, 0, binBytes);
+    for(unsigned int i = 0; i < philosopherCount; i++)
+    {
+        philosophers[i].eatsPerBin = &bins[(size_t)i*binStride];
+    }
+    return 0;
+}
+
+/**
+ * @brief Marks the start of a hunger period, later calls are ignored until
+ * the philosopher actually eats, so a polite philosopher that backs off and
+ * retries is still measured from the first time it got hungry
+ */
+void SimStats::became_hungry(unsigned int philosopher)
+{
+    PhilosopherStats &stats = philosophers[philosopher];
+    if(!stats.hungry)
+    {
+        stats.hungry = true;
+        stats.hungrySince = now_usec();
+    }
+}
+
+void SimStats::sched_requested(unsigned int philosopher)
+{
+    philosophers[philosopher].schedRequestedAt = now_usec();
+}
+
+void SimStats::sched_granted(unsigned int philosopher)
+{
+    PhilosopherStats &stats = philosophers[philosopher];
+    stats.schedLatency.record(now_usec() - stats.schedRequestedAt);
+}
+
+void SimStats::started_eating(unsigned int philosopher)
+{
+    PhilosopherStats &stats = philosophers[philosopher];
+    uint64_t now = now_usec();
+    if(stats.hungry)
+    {
+        stats.hungerToEat.record(now - stats.hungrySince);
+        stats.hungry = false;
+    }
+    stats.eatCount++;
+    uint64_t sinceStart = now - startUsec;
+    uint64_t bin = sinceStart < windowMsec*1000ull ? sinceStart/(THROUGHPUT_BIN_MSEC*1000) : binCount-1;
+    stats.eatsPerBin[bin]++;
+}
+
+/**
+ * @brief Marks the start of the measured window, once every philosopher is
+ * seated
+ */
+void SimStats::table_opened()
+{
+    startUsec = now_usec();
+}
+
+/**
+ * @brief Marks the end of the measured window, meals finishing during the
+ * shutdown still count but the time spent leaving does not
+ */
+void SimStats::table_closed()
+{
+    stopUsec = now_usec();
+}
+
+/**
+ * @brief Marks the philosopher gone. One still hungry when he leaves starved
+ * until now, that wait counts too, otherwise the policies starving people the
+ * most would report the shortest waits
+ */
+void SimStats::left_table(unsigned int philosopher)
+{
+    PhilosopherStats &stats = philosophers[philosopher];
+    stats.leftAt = now_usec();
+    if(stats.hungry)
+    {
+        stats.hungerToEat.record(stats.leftAt - stats.hungrySince);
+        stats.hungry = false;
+    }
+}
+
+/**
+ * @brief Marks every thread at the table (scheduler included) as joined
+ */
+void SimStats::everyone_left()
+{
+    joinedUsec = now_usec();
+}
+
+uint64_t SimStats::since_stop(uint64_t time)
+{
+    return time > stopUsec ? time - stopUsec : 0;
+}
+
+uint64_t SimStats::eat_count(unsigned int philosopher)
+{
+    return philosophers[philosopher].eatCount;
+}
+
+/**
+ * @brief Jain's fairness index over meals eaten, (sum x)^2 / (n * sum x^2).
+ * 1 means everybody ate equally, 1/n means a single philosopher ate it all
+ */
+double SimStats::jain_fairness()
+{
+    double sum = 0;
+    double sumOfSquares = 0;
+    for(unsigned int i = 0; i < philosopherCount; i++)
+    {
+        double eats = philosophers[i].eatCount;
+        sum += eats;
+        sumOfSquares += eats*eats;
+    }
+    if(sumOfSquares == 0)
+    {
+        return 0;
+    }
+    return (sum*sum)/(philosopherCount*sumOfSquares);
+}
+
+SimSummary SimStats::summarize()
+{
+    LatencyHistogram starvation;
+    LatencyHistogram scheduling;
+    LatencyHistogram shutdown;
+    SimSummary summary;
+
+    summary.meals = 0;
+    for(unsigned int i = 0; i < philosopherCount; i++)
+    {
+        summary.meals += philosophers[i].eatCount;
+        starvation.merge(philosophers[i].hungerToEat);
+        scheduling.merge(philosophers[i].schedLatency);
+        shutdown.record(since_stop(philosophers[i].leftAt));
+    }
+    uint64_t window = (stopUsec > startUsec ? stopUsec : now_usec()) - startUsec;
+    summary.eatsPerSec = window ? summary.meals*1e6/window : 0;
+    summary.fairness = jain_fairness();
+    summary.starvationP50 = starvation.percentile(50);
+    summary.starvationP99 = starvation.percentile(99);
+    summary.starvationMax = starvation.max();
+    summary.schedP50 = scheduling.percentile(50);
+    summary.schedP99 = scheduling.percentile(99);
+    summary.schedMax = scheduling.max();
+    summary.shutdownP50 = shutdown.percentile(50);
+    summary.shutdownP99 = shutdown.percentile(99);
+    summary.shutdownMax = shutdown.max();
+    summary.shutdownJoin = since_stop(joinedUsec);
+    return summary;
+}
+
+void SimStats::report()
+{
+    printf("Metrics (latencies in milliseconds)\n");
+    for(unsigned int i = 0; i < philosopherCount; i++)
+    {
+        PhilosopherStats &stats = philosophers[i];
+        printf("Philosopher[%d] has eaten %lu times, waited p50 %.3f p99 %.3f max %.3f\n", i, (unsigned long)stats.eatCount,
+            stats.hungerToEat.percentile(50)/1000.0, stats.hungerToEat.percentile(99)/1000.0, stats.hungerToEat.max()/1000.0);
+    }
+
+    SimSummary summary = summarize();
+    printf("Total Consumptions %lu\n", (unsigned long)summary.meals);
+    printf("Throughput %.1f eats/sec\n", summary.eatsPerSec);
+    printf("Jain's fairness index %.4f\n", summary.fairness);
+    printf("Starvation time p50 %.3f p99 %.3f max %.3f\n",
+        summary.starvationP50/1000.0, summary.starvationP99/1000.0, summary.starvationMax/1000.0);
+    if(summary.schedMax)
+    {
+        printf("Scheduler request to grant p50 %.3f p99 %.3f max %.3f\n",
+            summary.schedP50/1000.0, summary.schedP99/1000.0, summary.schedMax/1000.0);
+    }
+    printf("Shutdown, stop to philosopher leaving p50 %.3f p99 %.3f max %.3f, to every thread joined %.3f\n",
+        summary.shutdownP50/1000.0, summary.shutdownP99/1000.0, summary.shutdownMax/1000.0, summary.shutdownJoin/1000.0);
+
+    uint64_t *eatsPerBin = new uint64_t[binCount]();
+    unsigned int usedBins = 0;
+    for(unsigned int bin = 0; bin < binCount; bin++)
+    {
+        for(unsigned int i = 0; i < philosopherCount; i++)
+        {
+            eatsPerBin[bin] += philosophers[i].eatsPerBin[bin];
+        }
+        if(eatsPerBin[bin])
+        {
+            usedBins = bin+1;
+        }
+    }
+
+    printf("Throughput over time (eats/sec per %dms)\n", THROUGHPUT_BIN_MSEC);
+    for(unsigned int bin = 0; bin < usedBins; bin++)
+    {
+        uint64_t eats = eatsPerBin[bin];
+        if(bin == binCount-1)
+        {
+            // Open ended, there is no width to turn it into a rate
+            printf("  [%6u,    end)ms %8lu eats after the run\n", windowMsec, (unsigned long)eats);
+            break;
+        }
+        // The last bin of the run is cut short when the run time isn't a
+        // multiple of the bin
+        unsigned int binEnd = (bin+1)*THROUGHPUT_BIN_MSEC < windowMsec ? (bin+1)*THROUGHPUT_BIN_MSEC : windowMsec;
+        printf("  [%6u, %6u)ms %8.1f\n", bin*THROUGHPUT_BIN_MSEC, binEnd, eats*1000.0/(binEnd - bin*THROUGHPUT_BIN_MSEC));
+    }
+    delete[] eatsPerBin;
+}
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef StopToken_CPP
+#define StopToken_CPP
+
+#include <atomic>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/**
+ * Once a waiting thread can't be woken directly (a semaphore or a futex with
+ * nobody to post it), it checks the token at least this often
+ */
+#define STOP_CHECK_MSEC 50
+
+/**
+ * @brief Closing time for every thread at the table. The flag is atomic so a
+ * request is seen by every core without a lock, and sleeps are timed futex
+ * waits on the flag itself, so a thinking or eating philosopher wakes up the
+ * moment the stop is requested instead of finishing his nap. The kernel only
+ * parks a sleeper while the flag is still clear, a stop landing between the
+ * check and the wait can't be missed. Costs the same single syscall as usleep
+ */
+class StopToken
+{
+private:
+    std::atomic<uint32_t> stopped;
+
+public:
+    StopToken() : stopped(0) {}
+    bool stop_requested() const { return stopped.load(std::memory_order_acquire) != 0; }
+    void request_stop();
+    bool sleep_for(unsigned int msec) const;
+};
+
+void StopToken::request_stop()
+{
+    stopped.store(1, std::memory_order_release);
+    syscall(SYS_futex, (uint32_t*)&stopped, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
+}
+
+/**
+ * @brief Sleeps for msec unless the stop is requested first
+ *
+ * @return true if the full period was slept, false if interrupted by the stop
+ */
+bool StopToken::sleep_for(unsigned int msec) const
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += msec/1000;
+    deadline.tv_nsec += (long)(msec%1000)*1000000;
+    if(deadline.tv_nsec >= 1000000000l)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000l;
+    }
+    // Absolute deadline, so spurious wake ups don't stretch the nap
+    while(!stop_requested())
+    {
+        if(syscall(SYS_futex, (uint32_t*)&stopped, FUTEX_WAIT_BITSET_PRIVATE, 0, &deadline, NULL, FUTEX_BITSET_MATCH_ANY) != 0 &&
+           errno == ETIMEDOUT)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef Trace_CPP
+#define Trace_CPP
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/**
+ * Trace levels, pick one at compile time with -DTRACE_LEVEL=<n>. Anything
+ * above the selected level compiles down to nothing, so a TRACE_LEVEL_NONE
+ * build has no logging cost at all (no drain thread, no buffers, no calls)
+ */
+#define TRACE_LEVEL_NONE 0
+#define TRACE_LEVEL_STATE 1
+#define TRACE_LEVEL_VERBOSE 2
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TRACE_LEVEL_STATE
+#endif
+
+#define TRACE_RING_SIZE 4096
+#define TRACE_DRAIN_PERIOD_MSEC 2
+#define TRACE_DEFAULT_PATH "philosophers.trace"
+#define TRACE_MAGIC "PHTRACE1"
+#define TRACE_VERSION 2
+#define TRACE_NO_FORK 0xFFFFFFFFu
+#define CACHE_LINE 64
+
+enum TraceEventType : uint8_t
+{
+    TRACE_THINK,
+    TRACE_SCHED_REQUEST,
+    TRACE_SCHED_GRANTED,
+    TRACE_FORK_TRY,
+    TRACE_FORK_ACQUIRED,
+    TRACE_FORK_FAILED,
+    TRACE_FORK_RELEASED,
+    TRACE_EAT,
+    TRACE_LEAVE,
+    TRACE_SCHED_ARBITRATE,
+    TRACE_SCHED_DISPATCH,
+    TRACE_SCHED_SHUFFLE,
+    TRACE_SCHED_RELEASE_ALL,
+    TRACE_EVENT_TYPE_COUNT
+};
+
+/**
+ * @brief Fixed size binary record, written to the trace file as is. value holds
+ * the event specific payload (sleep period in msec for THINK/EAT, number of
+ * forks for the batched FORK_TRY/ACQUIRED/RELEASED, which carry no fork)
+ */
+struct TraceEvent
+{
+    uint64_t timestampNs;
+    uint32_t philosopher;
+    uint32_t fork;
+    uint32_t value;
+    uint8_t type;
+    uint8_t state;
+    uint16_t reserved;
+};
+
+struct TraceFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t eventSize;
+};
+
+const char* trace_event_name(uint8_t type)
+{
+    switch(type)
+    {
+        case TRACE_THINK:
+            return "THINK";
+        case TRACE_SCHED_REQUEST:
+            return "SCHED_REQUEST";
+        case TRACE_SCHED_GRANTED:
+            return "SCHED_GRANTED";
+        case TRACE_FORK_TRY:
+            return "FORK_TRY";
+        case TRACE_FORK_ACQUIRED:
+            return "FORK_ACQUIRED";
+        case TRACE_FORK_FAILED:
+            return "FORK_FAILED";
+        case TRACE_FORK_RELEASED:
+            return "FORK_RELEASED";
+        case TRACE_EAT:
+            return "EAT";
+        case TRACE_LEAVE:
+            return "LEAVE";
+        case TRACE_SCHED_ARBITRATE:
+            return "SCHED_ARBITRATE";
+        case TRACE_SCHED_DISPATCH:
+            return "SCHED_DISPATCH";
+        case TRACE_SCHED_SHUFFLE:
+            return "SCHED_SHUFFLE";
+        case TRACE_SCHED_RELEASE_ALL:
+            return "SCHED_RELEASE_ALL";
+        default:
+            return "INVALID EVENT!";
+    }
+}
+
+uint64_t trace_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec*1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+/**
+ * @brief Single producer single consumer ring. The owning thread is the only
+ * writer of head, the drain thread is the only writer of tail, both sit on
+ * their own cache line so producers never bounce the consumer's line. When
+ * the ring is full the event is dropped and counted rather than blocking the
+ * philosopher
+ */
+struct alignas(CACHE_LINE) TraceRing
+{
+    alignas(CACHE_LINE) std::atomic<uint64_t> head;
+    uint64_t dropped;
+    alignas(CACHE_LINE) std::atomic<uint64_t> tail;
+    alignas(CACHE_LINE) TraceEvent events[TRACE_RING_SIZE];
+
+    TraceRing() : head(0), dropped(0), tail(0) {}
+
+    void push(const TraceEvent &event)
+    {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if(h - tail.load(std::memory_order_acquire) >= TRACE_RING_SIZE)
+        {
+            dropped++;
+            return;
+        }
+        events[h & (TRACE_RING_SIZE-1)] = event;
+        head.store(h+1, std::memory_order_release);
+    }
+
+    /**
+     * @brief Writes everything published so far to out, at most two fwrite
+     * calls (ring may wrap)
+     *
+     * @return number of events written
+     */
+    uint64_t drain_to(FILE *out)
+    {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        uint64_t h = head.load(std::memory_order_acquire);
+        uint64_t pending = h - t;
+        if(pending == 0)
+        {
+            return 0;
+        }
+        uint64_t start = t & (TRACE_RING_SIZE-1);
+        uint64_t firstChunk = pending < TRACE_RING_SIZE - start ? pending : TRACE_RING_SIZE - start;
+        fwrite(&events[start], sizeof(TraceEvent), firstChunk, out);
+        if(pending > firstChunk)
+        {
+            fwrite(&events[0], sizeof(TraceEvent), pending - firstChunk, out);
+        }
+        tail.store(h, std::memory_order_release);
+        return pending;
+    }
+};
+
+class TraceLogger
+{
+private:
+    TraceRing *rings;
+    unsigned int ringCount;
+    FILE *out;
+    pthread_t drainThread;
+    std::atomic<bool> draining;
+    uint64_t written;
+    static void* drain_loop(void*);
+    void drain_all();
+
+public:
+    TraceLogger();
+    ~TraceLogger();
+    int start(unsigned int _ringCount, const char *path);
+    void stop();
+    TraceRing* ring(unsigned int);
+    uint64_t total_dropped();
+};
+
+/**
+ * @brief Each traced thread binds itself to its own ring once with
+ * trace_attach, after that recording an event touches nothing shared
+ */
+static thread_local TraceRing *localTraceRing = NULL;
+TraceLogger tracer;
+
+TraceLogger::TraceLogger() : rings(NULL), ringCount(0), out(NULL), draining(false), written(0)
+{
+}
+
+TraceLogger::~TraceLogger()
+{
+    stop();
+}
+
+int TraceLogger::start(unsigned int _ringCount, const char *path)
+{
+    out = fopen(path, "wb");
+    if(out == NULL)
+    {
+        printf("Failed to open trace file %s\n", path);
+        return -1;
+    }
+
+    try
+    {
+        rings = new TraceRing[_ringCount];
+    }
+    catch (const std::bad_alloc &e)
+    {
+        printf("Failed to allocate trace buffers, ERROR %s\n", e.what());
+        fclose(out);
+        out = NULL;
+        return -1;
+    }
+    ringCount = _ringCount;
+
+    TraceFileHeader header;
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.eventSize = sizeof(TraceEvent);
+    fwrite(&header, sizeof(header), 1, out);
+
+    draining = true;
+    if(pthread_create(&drainThread, NULL, &TraceLogger::drain_loop, this))
+    {
+        printf("Failed to dispatch trace drain thread\n");
+        draining = false;
+        return -1;
+    }
+    return 0;
+}
+
+void TraceLogger::drain_all()
+{
+    for(unsigned int i = 0; i < ringCount; i++)
+    {
+        written += rings[i].drain_to(out);
+    }
+}
+
+void* TraceLogger::drain_loop(void *args)
+{
+    TraceLogger *self = (TraceLogger*)args;
+    while(self->draining.load(std::memory_order_acquire))
+    {
+        self->drain_all();
+        usleep(TRACE_DRAIN_PERIOD_MSEC*1000);
+    }
+    return 0;
+}
+
+/**
+ * @brief Stops the drain thread and flushes whatever is left in the rings.
+ * Must only be called once every traced thread is done recording
+ */
+void TraceLogger::stop()
+{
+    if(out == NULL)
+    {
+        return;
+    }
+    if(draining.exchange(false))
+    {
+        pthread_join(drainThread, NULL);
+    }
+    drain_all();
+    fclose(out);
+    out = NULL;
+    printf("Trace wrote %lu events, dropped %lu\n", (unsigned long)written, (unsigned long)total_dropped());
+    delete[] rings;
+    rings = NULL;
+    ringCount = 0;
+}
+
+TraceRing* TraceLogger::ring(unsigned int index)
+{
+    return index < ringCount ? &rings[index] : NULL;
+}
+
+uint64_t TraceLogger::total_dropped()
+{
+    uint64_t total = 0;
+    for(unsigned int i = 0; i < ringCount; i++)
+    {
+        total += rings[i].dropped;
+    }
+    return total;
+}
+
+void trace_attach(unsigned int ringIndex)
+{
+    localTraceRing = tracer.ring(ringIndex);
+}
+
+void trace_record(uint8_t type, uint32_t philosopher, uint8_t state, uint32_t fork, uint32_t value)
+{
+    if(localTraceRing == NULL)
+    {
+        return;
+    }
+    TraceEvent event;
+    event.timestampNs = trace_now_ns();
+    event.philosopher = philosopher;
+    event.fork = fork;
+    event.value = value;
+    event.type = type;
+    event.state = state;
+    event.reserved = 0;
+    localTraceRing->push(event);
+}
+
+#if TRACE_LEVEL >= TRACE_LEVEL_STATE
+#define TRACE_START(rings, path) tracer.start(rings, path)
+#define TRACE_STOP() tracer.stop()
+#define TRACE_ATTACH(ring) trace_attach(ring)
+#define TRACE_STATE(type, philosopher, state, fork, value) trace_record(type, philosopher, state, fork, value)
+#else
+#define TRACE_START(rings, path) 0
+#define TRACE_STOP() do {} while(0)
+#define TRACE_ATTACH(ring) do {} while(0)
+#define TRACE_STATE(type, philosopher, state, fork, value) do {} while(0)
+#endif
+
+#if TRACE_LEVEL >= TRACE_LEVEL_VERBOSE
+#define TRACE_VERBOSE(type, philosopher, state, fork, value) trace_record(type, philosopher, state, fork, value)
+#else
+#define TRACE_VERBOSE(type, philosopher, state, fork, value) do {} while(0)
+#endif
+
+#endif
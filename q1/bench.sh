@@ -0,0 +1,91 @@
+#!/bin/bash
+# Parameter sweep over the philosophers simulation. Every configuration is run
+# TRIALS times and each run appends one row to $OUT.csv, which is converted to
+# $OUT.json at the end. Override any of the lists below from the environment,
+# e.g. SIZES="5 50" TRIALS=1 ./bench.sh
+BIN=${BIN:-./main_bench}
+OUT=${OUT:-bench_results}
+SIZES=${SIZES:-"5 50 500 5000 10000"}
+POLICIES=${POLICIES:-"greedy-ordered polite-ordered chandy-misra"}
+SLEEPS=${SLEEPS:-"uniform fixed"}
+SCHED_FREQS=${SCHED_FREQS:-"5 20 80"}
+SHUFFLE_TRIGGERS=${SHUFFLE_TRIGGERS:-"1 3 10"}
+TRIALS=${TRIALS:-3}
+RUNTIME=${RUNTIME:-2000}
+# The scheduler's warm-up would sit inside every measured window
+SCHED_WARMUP=${SCHED_WARMUP:-0}
+if [ -z "$CPUS" ]; then
+    # Powers of two up to the machine, plus the machine itself
+    ONLINE=$(nproc)
+    for ((cpus=1; cpus<ONLINE; cpus*=2)); do CPUS="$CPUS $cpus"; done
+    CPUS="$CPUS $ONLINE"
+fi
+
+RUN_CSV=$(mktemp)
+rm -f $OUT.csv
+
+# run <trial> <main arguments...>
+run() {
+    local trial=$1
+    shift
+    rm -f $RUN_CSV
+    if ! $BIN "$@" --runtime $RUNTIME --csv $RUN_CSV > /dev/null; then
+        echo "FAILED: $BIN $*" >&2
+        return
+    fi
+    if [ ! -s $OUT.csv ]; then
+        head -1 $RUN_CSV | sed 's/^/trial,/' > $OUT.csv
+    fi
+    tail -1 $RUN_CSV | sed "s/^/$trial,/" >> $OUT.csv
+    tail -1 $OUT.csv
+}
+
+for size in $SIZES; do
+    for cpus in $CPUS; do
+        for sleep in $SLEEPS; do
+            for trial in $(seq 1 $TRIALS); do
+                for policy in $POLICIES; do
+                    run $trial $size $size --cpus $cpus --sleep $sleep --forks $policy
+                done
+                for freq in $SCHED_FREQS; do
+                    for trigger in $SHUFFLE_TRIGGERS; do
+                        run $trial $size $size --cpus $cpus --sleep $sleep --forks greedy-ordered \
+                            --sched central --sched-freq $freq --shuffle-trigger $trigger \
+                            --sched-warmup $SCHED_WARMUP
+                    done
+                done
+            done
+        done
+    done
+done
+rm -f $RUN_CSV
+
+# csv -> json, numbers stay numbers
+awk -F, 'NR == 1 { for(i = 1; i <= NF; i++) name[i] = $i; print "["; next }
+    {
+        printf("%s  {", NR > 2 ? ",\n" : "");
+        for(i = 1; i <= NF; i++)
+        {
+            value = ($i ~ /^-?[0-9.]+$/) ? $i : "\"" $i "\"";
+            printf("%s\"%s\": %s", i > 1 ? ", " : "", name[i], value);
+        }
+        printf("}");
+    }
+    END { print "\n]" }' $OUT.csv > $OUT.json
+
+# Mean over trials per configuration
+echo
+echo "philosophers cpus sleep fork_policy sched freq trigger | eats/sec fairness starvation_p99_ms ctx_switches cpu_s shutdown_ms"
+awk -F, 'NR > 1 {
+        key = $2 " " $9 " " $5 " " $4 " " $6 " " $7 " " $8;
+        if(!(key in runs)) order[++keys] = key;
+        runs[key]++; eats[key] += $12; fair[key] += $13; p99[key] += $15;
+        ctx[key] += $18 + $19; cpu[key] += $20 + $21; shutdown[key] += $24;
+    }
+    END {
+        for(k = 1; k <= keys; k++) {
+            key = order[k]; n = runs[key];
+            printf("%s | %.1f %.4f %.3f %d %.3f %.3f\n", key, eats[key]/n, fair[key]/n, p99[key]/n, ctx[key]/n, cpu[key]/n, shutdown[key]/n);
+        }
+    }' $OUT.csv
+echo "Results in $OUT.csv and $OUT.json"
@@ -0,0 +1,23 @@
+#!/bin/bash
+# Throughput against graph density: a fixed pool of agents and resources where
+# every agent needs k resources at once, k grows until agents need most of the
+# pool. Prints one line per run: k, capacity, policy, meals, fairness
+# Untraced and optimized like the sweep (make main_bench), tracing would be
+# measured along with the simulation
+BIN=${BIN:-./main_bench}
+AGENTS=${AGENTS:-32}
+RESOURCES=${RESOURCES:-32}
+TOPOLOGY=$(mktemp)
+echo "k capacity policy meals jain"
+for capacity in 1 2; do
+    for k in 2 3 4 6 8; do
+        ./gen_topology.sh $AGENTS $RESOURCES $k $capacity > $TOPOLOGY
+        for policy in greedy-ordered polite-ordered; do
+            $BIN --topology $TOPOLOGY --forks $policy | awk -v k=$k -v capacity=$capacity -v policy=$policy '
+                /^Total Consumptions/ { meals = $3 }
+                /^Jain/ { jain = $4 }
+                END { print k, capacity, policy, meals, jain }'
+        done
+    done
+done
+rm -f $TOPOLOGY
@@ -0,0 +1,34 @@
+#!/bin/bash
+# Random resource graph: every agent needs k distinct resources picked
+# uniformly out of the pool, all resources get the same capacity.
+# usage: ./gen_topology.sh <agents> <resources> <k> [capacity] [seed] > file
+AGENTS=$1
+RESOURCES=$2
+K=$3
+CAPACITY=${4:-1}
+SEED=${5:-1}
+if [ -z "$K" ] || [ "$K" -gt "$RESOURCES" ]; then
+    echo "usage: $0 <agents> <resources> <k <= resources> [capacity] [seed]" >&2
+    exit 1
+fi
+awk -v agents=$AGENTS -v resources=$RESOURCES -v k=$K -v capacity=$CAPACITY -v seed=$SEED 'BEGIN {
+    srand(seed);
+    printf("# %d agents, %d resources of capacity %d, %d resources per agent\n", agents, resources, capacity, k);
+    printf("resources %d\n", resources);
+    if(capacity > 1)
+        for(r = 0; r < resources; r++)
+            printf("capacity %d %d\n", r, capacity);
+    for(a = 0; a < agents; a++) {
+        delete taken;
+        line = "agent";
+        for(picked = 0; picked < k; ) {
+            r = int(rand()*resources);
+            if(!(r in taken)) {
+                taken[r] = 1;
+                line = line " " r;
+                picked++;
+            }
+        }
+        print line;
+    }
+}'
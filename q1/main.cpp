@@ -6,37 +6,65 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <iostream>
+#include <string.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include "Trace.cpp"
+#include "Stats.cpp"
 #include "Scheduler.cpp"
+#include "ChandyMisra.cpp"
 
 
 #define SUCCESS true
 #define FAIL false
 #define MSEC 1000
 
-#define GREEDY
-#define GET_FORKS_IN_ORDER
-// #define PROLETARIAT
 #define RUN_TIME_IN_MSEC 5000
 #define MAX_SLEEP_PERIOD 25 
-// #define ENABLE_SCHED
 #define SCHED_UPDATE_FREQ 20
 #define SCHED_SHUFFLE_TRIGGER 3
+#define SCHED_WARMUP_MSEC 500
 #define SCHED_ENABLE_SHUFFLE true
+#define PHILOSOPHER_STACK_SIZE (256*1024)
 
 using std::queue;
 using std::swap;
 
+enum ForkPolicy {FORKS_GREEDY_ORDERED, FORKS_GREEDY, FORKS_POLITE_ORDERED, FORKS_POLITE, FORKS_CHANDY_MISRA, FORK_POLICY_COUNT};
+enum SleepPolicy {SLEEP_UNIFORM, SLEEP_FIXED, SLEEP_POLICY_COUNT};
+enum SchedPolicy {SCHED_NONE, SCHED_CENTRAL, SCHED_POLICY_COUNT};
+const char* forkPolicyNames[FORK_POLICY_COUNT] = {"greedy-ordered", "greedy", "polite-ordered", "polite", "chandy-misra"};
+const char* sleepPolicyNames[SLEEP_POLICY_COUNT] = {"uniform", "fixed"};
+const char* schedPolicyNames[SCHED_POLICY_COUNT] = {"none", "central"};
+
+struct SimConfig
+{
+    ForkPolicy forks;
+    SleepPolicy sleep;
+    SchedPolicy sched;
+    const char *topology;
+    unsigned int runTimeMsec;
+    unsigned int schedUpdateFreq;
+    unsigned int schedShuffleTrigger;
+    unsigned int schedWarmupMsec;
+    unsigned int cpus;
+    const char *csvPath;
+} config = {FORKS_GREEDY_ORDERED, SLEEP_UNIFORM, SCHED_NONE, NULL, RUN_TIME_IN_MSEC, SCHED_UPDATE_FREQ, SCHED_SHUFFLE_TRIGGER, SCHED_WARMUP_MSEC, 0, NULL};
+
 unsigned int philosopherCount = 5;
 unsigned int forksCount = 5;
-static bool stillSitting = true;
+StopToken closingTime;
 enum PhilosopherState {THINKING, PICKING_UP_FORK, EATING, PUTTING_DOWN_FORKS};
 pthread_t *philosophers;
 pthread_t terminatorThread;
 pthread_t schedulerThread;
-pthread_mutex_t *forks;
+ResourceGraph table;
 unsigned int *threadArgs;
 Scheduler *sched;
-unsigned int *eatCounter; 
+HygienicTable *hygienicTable;
+SimStats stats;
+// Everyone sits down before the clock starts, main included
+pthread_barrier_t seatedGate;
 
 void* runScheduler(void *args)
 {
@@ -45,10 +73,10 @@ void* runScheduler(void *args)
 }
 
 /**
- * @brief Sends termination signal through bool stillSitting to threads. Since
- * some threads may be sleeping (THINKING/ EATING) they will not respond
- * immediately and will have to finish up their usage of the resource in order
- * to leave it in a consistent state
+ * @brief Requests the stop through closingTime. Thinking and eating
+ * philosophers wake up from their nap straight away, the ones waiting on a
+ * fork or the scheduler give up their wait (see StopToken), everyone puts down
+ * what he holds to leave the table in a consistent state
  * 
  * @param args time that terminator waits before terminating, cast to unsigned int
  * @return void* 
@@ -57,8 +85,13 @@ void* terminator(void *args)
 {
     unsigned int timeTillTermination = *((unsigned int*)args);
     usleep(MSEC*timeTillTermination);    
-    stillSitting = false;
-    printf("Terminator has just told everyone to leave and cleanup... this may take a while...\n");
+    stats.table_closed();
+    closingTime.request_stop();
+    if(hygienicTable != NULL)
+    {
+        hygienicTable->wake_all();
+    }
+    printf("Terminator has just told everyone to leave and cleanup...\n");
     return 0;
 }
 
@@ -76,40 +109,6 @@ void seed_random_generator()
     }
 }
 
-unsigned int get_sleep_period()
-{
-    #ifdef PROLETARIAT
-        return MAX_SLEEP_PERIOD;
-    #else
-        return rand()%MAX_SLEEP_PERIOD;
-    #endif
-}
-
-void sort(unsigned int *first, unsigned int *second)
-{
-    unsigned int temp; 
-    if(*first > *second)
-    {
-        temp = *first;
-        *first = *second;
-        *second = temp;
-    }
-}
-
-bool pickup_fork(unsigned int forkNum)
-{
-    #ifdef GREEDY
-    pthread_mutex_lock(&forks[forkNum]);
-    #else
-    if(!(pthread_mutex_trylock(&forks[forkNum])))
-    {
-        return false;
-    }
-    #endif
-
-    return true;
-}
-
 std::string convert_enum(PhilosopherState state)
 {
     switch(state)
@@ -127,112 +126,267 @@ std::string convert_enum(PhilosopherState state)
     }
 }
 
-void putdown_fork(unsigned int fork)
+/**
+ * Policies, each philosopher loop is instantiated once per combination of
+ * fork acquisition, sleep distribution and scheduling so none of these choices
+ * cost a branch inside the loop. The CLI picks the instantiation at startup
+ */
+
+/**
+ * @brief Greedy philosophers block on their forks until they are free. Ordered
+ * ones wait on the graph's sorted batch, the others on their forks as listed
+ */
+struct GreedyPickup
 {
-    pthread_mutex_unlock(&forks[fork]);
-}
+    template<bool Ordered>
+    static bool pickup_all(unsigned int philosopher, const unsigned int *forks, unsigned int count)
+    {
+        if(Ordered)
+        {
+            return table.acquire_all(table.batch_of(philosopher), closingTime);
+        }
+        return table.acquire_in_listed_order(philosopher, closingTime);
+    }
+};
+
+/**
+ * @brief Polite philosophers only take their forks if they are all free right
+ * now and back off otherwise
+ */
+struct PolitePickup
+{
+    template<bool Ordered>
+    static bool pickup_all(unsigned int philosopher, const unsigned int *forks, unsigned int count)
+    {
+        return table.try_acquire_all(forks, count);
+    }
+};
+
+/**
+ * @brief Fork acquisition over the resource graph (the classic ring unless a
+ * topology was loaded). With Ordered the forks are picked up in ascending
+ * index order, which guarantees there is always a left philosopher on the
+ * table (no circular wait). Otherwise every philosopher picks them up in the
+ * order he lists them, left then right on the ring
+ */
+template<class Pickup, bool Ordered>
+class ResourceForks
+{
+private:
+    unsigned int philosopherNumber;
+    vector<unsigned int> forks;
+    bool holdingForks;
+
+public:
+    ResourceForks(unsigned int _philosopherNumber) : philosopherNumber(_philosopherNumber), holdingForks(false)
+    {
+        if(Ordered)
+        {
+            const ResourceBatch &batch = table.batch_of(philosopherNumber);
+            forks.assign(batch.data(), batch.data()+batch.size());
+        }
+        else
+        {
+            forks = table.needs_of(philosopherNumber);
+        }
+    }
+
+    /**
+     * @brief will work with both greedy and non greedy philosophers greedy
+     * will block until has all, non greedy will fail to get all and back off
+     * (will relinquish any fork that was successfully acquired).
+     *
+     * @return true if every fork is held
+     */
+    bool pickup_forks(PhilosopherState state)
+    {
+        TRACE_VERBOSE(TRACE_FORK_TRY, philosopherNumber, state, TRACE_NO_FORK, forks.size());
+        holdingForks = Pickup::template pickup_all<Ordered>(philosopherNumber, forks.data(), forks.size());
+        if(holdingForks == SUCCESS)
+        {
+            TRACE_VERBOSE(TRACE_FORK_ACQUIRED, philosopherNumber, state, TRACE_NO_FORK, forks.size());
+            return SUCCESS;
+        }
+
+        TRACE_STATE(TRACE_FORK_FAILED, philosopherNumber, state, TRACE_NO_FORK, 0);
+        return FAIL;
+    }
+
+    void putdown_forks(PhilosopherState state)
+    {
+        TRACE_VERBOSE(TRACE_FORK_RELEASED, philosopherNumber, state, TRACE_NO_FORK, forks.size());
+        table.release_all(forks.data(), forks.size());
+        holdingForks = false;
+    }
+
+    void putdown_held_forks(PhilosopherState state)
+    {
+        if(holdingForks)
+        {
+            putdown_forks(state);
+        }
+    }
+};
+
+typedef ResourceForks<GreedyPickup, true> GreedyOrderedForks;
+typedef ResourceForks<GreedyPickup, false> GreedyForks;
+typedef ResourceForks<PolitePickup, true> PoliteOrderedForks;
+typedef ResourceForks<PolitePickup, false> PoliteForks;
+
+/**
+ * @brief Chandy-Misra fork passing (see HygienicTable), forks travel between
+ * neighbours instead of being locked, so there is no ordering and no lock
+ * wider than a single fork
+ */
+class HygienicForks
+{
+private:
+    unsigned int philosopherNumber;
+    vector<unsigned int> forks;
+    bool eating;
+
+public:
+    HygienicForks(unsigned int _philosopherNumber) : philosopherNumber(_philosopherNumber), eating(false)
+    {
+        forks = table.needs_of(philosopherNumber);
+    }
+
+    /**
+     * @brief Blocks until every fork has arrived
+     *
+     * @return FAIL only if the table closed while waiting
+     */
+    bool pickup_forks(PhilosopherState state)
+    {
+        TRACE_VERBOSE(TRACE_FORK_TRY, philosopherNumber, state, TRACE_NO_FORK, forks.size());
+        eating = hygienicTable->pickup(philosopherNumber, forks.data(), forks.size());
+        if(eating)
+        {
+            TRACE_VERBOSE(TRACE_FORK_ACQUIRED, philosopherNumber, state, TRACE_NO_FORK, forks.size());
+        }
+        else
+        {
+            TRACE_STATE(TRACE_FORK_FAILED, philosopherNumber, state, TRACE_NO_FORK, 0);
+        }
+        return eating;
+    }
+
+    void putdown_forks(PhilosopherState state)
+    {
+        TRACE_VERBOSE(TRACE_FORK_RELEASED, philosopherNumber, state, TRACE_NO_FORK, forks.size());
+        hygienicTable->putdown(philosopherNumber, forks.data(), forks.size());
+        eating = false;
+    }
+
+    void putdown_held_forks(PhilosopherState state)
+    {
+        if(eating)
+        {
+            putdown_forks(state);
+        }
+    }
+};
+
+struct UniformSleep
+{
+    static unsigned int period()
+    {
+        return rand()%MAX_SLEEP_PERIOD;
+    }
+};
+
+/**
+ * @brief Proletariat philosophers always think and eat for the full period
+ */
+struct FixedSleep
+{
+    static unsigned int period()
+    {
+        return MAX_SLEEP_PERIOD;
+    }
+};
+
+struct NoScheduler
+{
+    static bool request_to_eat(unsigned int philosopherNumber, PhilosopherState state)
+    {
+        return SUCCESS;
+    }
+};
+
+struct CentralScheduler
+{
+    /**
+     * @return FAIL if the scheduler closed before granting the request
+     */
+    static bool request_to_eat(unsigned int philosopherNumber, PhilosopherState state)
+    {
+        TRACE_VERBOSE(TRACE_SCHED_REQUEST, philosopherNumber, state, TRACE_NO_FORK, 0);
+        stats.sched_requested(philosopherNumber);
+        if(!sched->make_eat_request(philosopherNumber))
+        {
+            return FAIL;
+        }
+        stats.sched_granted(philosopherNumber);
+        TRACE_STATE(TRACE_SCHED_GRANTED, philosopherNumber, state, TRACE_NO_FORK, 0);
+        return SUCCESS;
+    }
+};
 
 /**
  * @brief This function is basically the main for each philosopher. It
- * identifies the philosopher by his thread number, and defines which forks he
- * should take first. If the GET_FORKS_IN_ORDER flag is raised she will pickup
- * the forks depending their ascending index order. This is done via a sort
- * call. This guarantees that on any given table there will always be a left
- * philosopher (philosopher that will pickup the left fork first before the
- * right one). Otherwise the order will always be left fork then right fork with
- * no righty philosophers. To guarantee no starvation a scheduler has been
- * implemented with dynamic and fixed priority for philosophers
+ * identifies the philosopher by his thread number and lets the Forks policy
+ * decide which forks he should take first and how (see ResourceForks). To
+ * guarantee no starvation a scheduler has been implemented with dynamic and
+ * fixed priority for philosophers, the Sched policy decides whether a
+ * philosopher has to ask it before picking up forks
  *
  * @param args thread number based on dispatch order, becomes philosoper num
  * @return void* 
  */
+template<class Forks, class Sleep, class Sched>
 void* sit_down_on_table(void* args)
 {
     unsigned int philosopherNumber =  *((unsigned int*)args);
-    unsigned int firstFork = philosopherNumber;
-    unsigned int secondFork = (philosopherNumber+1)%forksCount;
-    bool tryToPickUpSecondForks = false;
-    bool tryToPickUpFirstFork = false;
-
+    Forks hands(philosopherNumber);
 
     PhilosopherState state = THINKING;
-    #ifdef GET_FORKS_IN_ORDER
-    sort(&firstFork, &secondFork);
-    #endif
-    while(stillSitting)
+    TRACE_ATTACH(philosopherNumber);
+    pthread_barrier_wait(&seatedGate);
+    while(!closingTime.stop_requested())
     {
         switch (state)
         {
         case THINKING:
         {
-            unsigned int thinkingPeriod = get_sleep_period();
-            printf("Philosopher[%d] is about to THINK for %d milliseconds\n", philosopherNumber, thinkingPeriod);
-            usleep(MSEC*thinkingPeriod);
+            unsigned int thinkingPeriod = Sleep::period();
+            TRACE_STATE(TRACE_THINK, philosopherNumber, state, TRACE_NO_FORK, thinkingPeriod);
+            closingTime.sleep_for(thinkingPeriod);
             state = PICKING_UP_FORK;
+            stats.became_hungry(philosopherNumber);
             break;
         }
             
         case PICKING_UP_FORK:
         {
-            /**
-             * @brief will work with both greedy and non greedy philosophers
-             * greedy will block until has both, non greedy will fail to get 
-             * both and back off (will relinquish fork that was successfully 
-             * acquired if one was acquired).  
-             */
-            printf("Philosopher[%d] is asking scheduler to eat\n", philosopherNumber);
-
-            #ifdef ENABLE_SCHED
-            sched->make_eat_request(philosopherNumber);
-            #endif
-
-            printf("Philosopher[%d] has been granted the ability to eat by scheduler\n", philosopherNumber);
-
-            printf("Philosopher[%d] is trying to pickup firstFork[%d]\n", philosopherNumber, firstFork);
-            tryToPickUpFirstFork = pickup_fork(firstFork);
-            printf("Philosopher[%d] has picked-up firstFork[%d]!!\n", philosopherNumber, firstFork);
-            printf("Philosopher[%d] is trying to pickup secondFork[%d]\n", philosopherNumber, secondFork);
-            tryToPickUpSecondForks = pickup_fork(secondFork);
-            printf("Philosopher[%d] has picked-up secondFork[%d]!!\n", philosopherNumber, secondFork);
-            if(tryToPickUpFirstFork == SUCCESS && tryToPickUpSecondForks == SUCCESS)
-            {
-                state = EATING;
-            }
-            else
-            {
-                printf("Philosopher[%d] couldn't pickup both forks\n", philosopherNumber);
-                if(tryToPickUpFirstFork)
-                {
-                    printf("Philosopher[%d] was holding on to firstFork[%d] and has now released it\n", philosopherNumber, firstFork);
-                    putdown_fork(firstFork);
-                }
-                if(tryToPickUpSecondForks)
-                {
-                    printf("Philosopher[%d] was holding on to secondFork[%d] and has now released it\n", philosopherNumber, secondFork);
-                    putdown_fork(secondFork);
-                }
-                state = THINKING;
-            }
-            
+            bool granted = Sched::request_to_eat(philosopherNumber, state) == SUCCESS;
+            state = granted && hands.pickup_forks(state) == SUCCESS ? EATING : THINKING;
             break;
         }
             
         case EATING:
         {
-            unsigned int eatingPeriod = get_sleep_period();
-            printf("Philosopher[%d] is about to EAT for %d milliseconds\n", philosopherNumber, eatingPeriod);
-            usleep(MSEC*eatingPeriod);
-            eatCounter[philosopherNumber]++;
+            unsigned int eatingPeriod = Sleep::period();
+            TRACE_STATE(TRACE_EAT, philosopherNumber, state, TRACE_NO_FORK, eatingPeriod);
+            stats.started_eating(philosopherNumber);
+            closingTime.sleep_for(eatingPeriod);
             state = PUTTING_DOWN_FORKS;
             break;
         }
             
         case PUTTING_DOWN_FORKS:
         {
-            printf("Philosopher[%d] is putting down fork %d\n", philosopherNumber, secondFork);
-            putdown_fork(secondFork);
-            printf("Philosopher[%d] is putting down fork %d\n", philosopherNumber, firstFork);
-            putdown_fork(firstFork);
+            hands.putdown_forks(state);
             state = THINKING;
             break;
         }
@@ -241,53 +395,280 @@ void* sit_down_on_table(void* args)
             break;
         }
     }
-    printf("Philosopher[%d] is done exploring the mysteries of the universe, he was last seen %s\n", philosopherNumber, (convert_enum(state)).c_str());
+    TRACE_STATE(TRACE_LEAVE, philosopherNumber, state, TRACE_NO_FORK, 0);
+
+    hands.putdown_held_forks(state);
+    stats.left_table(philosopherNumber);
+    return 0;
+}
+
+typedef void* (*PhilosopherRoutine)(void*);
+
+template<class Forks, class Sleep>
+PhilosopherRoutine select_sched_policy()
+{
+    switch(config.sched)
+    {
+        case SCHED_CENTRAL:
+            return &sit_down_on_table<Forks, Sleep, CentralScheduler>;
+        default:
+            return &sit_down_on_table<Forks, Sleep, NoScheduler>;
+    }
+}
 
-    if(tryToPickUpFirstFork)
+template<class Forks>
+PhilosopherRoutine select_sleep_policy()
+{
+    switch(config.sleep)
     {
-        printf("Philosopher[%d] was holding fork number %d and is now putting it down\n", philosopherNumber, firstFork);
-        putdown_fork(firstFork);
+        case SLEEP_FIXED:
+            return select_sched_policy<Forks, FixedSleep>();
+        default:
+            return select_sched_policy<Forks, UniformSleep>();
     }
-    if(tryToPickUpSecondForks)
+}
+
+/**
+ * @brief Maps the policies picked on the command line to the matching
+ * instantiation of sit_down_on_table
+ */
+PhilosopherRoutine select_philosopher_routine()
+{
+    switch(config.forks)
     {
-        printf("Philosopher[%d] was holding fork number %d and is now putting it down\n", philosopherNumber, secondFork);
-        putdown_fork(secondFork);
+        case FORKS_GREEDY:
+            return select_sleep_policy<GreedyForks>();
+        case FORKS_POLITE_ORDERED:
+            return select_sleep_policy<PoliteOrderedForks>();
+        case FORKS_POLITE:
+            return select_sleep_policy<PoliteForks>();
+        case FORKS_CHANDY_MISRA:
+            return select_sleep_policy<HygienicForks>();
+        default:
+            return select_sleep_policy<GreedyOrderedForks>();
     }
-    return 0;
+}
+
+void print_usage()
+{
+    printf("usage: ./main <philosophers> <forks> [--forks greedy-ordered|greedy|polite-ordered|polite|chandy-misra] [--sleep uniform|fixed] [--sched none|central]\n");
+    printf("       ./main --topology <file> [options]\n");
+    printf("       other options: --runtime <msec> --sched-freq <msec> --shuffle-trigger <ticks> --sched-warmup <msec> --cpus <count> --csv <file>\n");
+}
+
+/**
+ * @brief Looks name up in a policy name table
+ *
+ * @return index of the policy, -1 if there is no such policy
+ */
+int parse_policy(const char *name, const char *const names[], int count)
+{
+    for(int i = 0; i < count; i++)
+    {
+        if(strcmp(name, names[i]) == 0)
+        {
+            return i;
+        }
+    }
+    printf("Unknown policy %s\n", name);
+    return -1;
+}
+
+/**
+ * @brief Reads a number option, at least min (strictly positive by default)
+ *
+ * @return false if text is not entirely a number or below min
+ */
+bool parse_count(const char *text, unsigned int *count, long min = 1)
+{
+    char *end;
+    long value = strtol(text, &end, 10);
+    if(end == text || *end != '\0' || value < min || value > UINT32_MAX)
+    {
+        return false;
+    }
+    *count = value;
+    return true;
 }
 
 int parse_args(int argc, char const *argv[])
 {
-    if(argc != 3)
+    // Table size can be left out when it comes from a topology file
+    int firstOption = (argc > 1 && strncmp(argv[1], "--", 2) == 0) ? 1 : 3;
+    if(argc < firstOption || (argc-firstOption)%2 != 0)
     {
         
         printf("Invalid number of arguments received, need number of philosophers and forks!\n");
+        print_usage();
         return -1;
     }
-    else
+    else if(firstOption == 3)
+    {
+        if(!parse_count(argv[1], &philosopherCount) || !parse_count(argv[2], &forksCount))
+        {
+            printf("Invalid table size %s %s, need positive numbers of philosophers and forks!\n", argv[1], argv[2]);
+            print_usage();
+            return -1;
+        }
+        printf("Received philosopher count %u\n", philosopherCount);
+        printf("Received forks count %u\n", forksCount);
+    }
+
+    for(int i = firstOption; i < argc; i += 2)
     {
-        philosopherCount = atoi(argv[1]);
-        forksCount = atoi(argv[2]);
-        if(forksCount < philosopherCount)
+        int policy;
+        if(strcmp(argv[i], "--topology") == 0)
+        {
+            config.topology = argv[i+1];
+            continue;
+        }
+        if(strcmp(argv[i], "--csv") == 0)
+        {
+            config.csvPath = argv[i+1];
+            continue;
+        }
+        if((strcmp(argv[i], "--runtime") == 0 && parse_count(argv[i+1], &config.runTimeMsec)) ||
+           (strcmp(argv[i], "--sched-freq") == 0 && parse_count(argv[i+1], &config.schedUpdateFreq)) ||
+           (strcmp(argv[i], "--shuffle-trigger") == 0 && parse_count(argv[i+1], &config.schedShuffleTrigger)) ||
+           (strcmp(argv[i], "--sched-warmup") == 0 && parse_count(argv[i+1], &config.schedWarmupMsec, 0)) ||
+           (strcmp(argv[i], "--cpus") == 0 && parse_count(argv[i+1], &config.cpus)))
         {
-            printf("Forks cannot be less than philosophers!\n");
+            continue;
+        }
+        if(strcmp(argv[i], "--forks") == 0 && (policy = parse_policy(argv[i+1], forkPolicyNames, FORK_POLICY_COUNT)) >= 0)
+        {
+            config.forks = (ForkPolicy)policy;
+        }
+        else if(strcmp(argv[i], "--sleep") == 0 && (policy = parse_policy(argv[i+1], sleepPolicyNames, SLEEP_POLICY_COUNT)) >= 0)
+        {
+            config.sleep = (SleepPolicy)policy;
+        }
+        else if(strcmp(argv[i], "--sched") == 0 && (policy = parse_policy(argv[i+1], schedPolicyNames, SCHED_POLICY_COUNT)) >= 0)
+        {
+            config.sched = (SchedPolicy)policy;
+        }
+        else
+        {
+            printf("Invalid option %s %s\n", argv[i], argv[i+1]);
+            print_usage();
             return -1;
         }
-        printf("Received philosopher count %d\n", philosopherCount);
-        printf("Received forks count %d\n", forksCount);
     }
+    if(firstOption == 1 && config.topology == NULL)
+    {
+        printf("Need number of philosophers and forks or a topology!\n");
+        print_usage();
+        return -1;
+    }
+    if(config.topology == NULL && forksCount != philosopherCount)
+    {
+        printf("The ring has exactly one fork per philosopher, use --topology for any other table!\n");
+        return -1;
+    }
+    printf("Received policies forks %s, sleep %s, sched %s\n", forkPolicyNames[config.forks], sleepPolicyNames[config.sleep], schedPolicyNames[config.sched]);
     return 0;
 }
 
+/**
+ * @brief Sets the table up, the classic ring of philosopherCount philosophers
+ * and as many forks unless a topology file was given, in which case the
+ * file decides how many philosophers sit down
+ */
+int build_table()
+{
+    if(config.topology != NULL)
+    {
+        if(table.load(config.topology))
+        {
+            return -1;
+        }
+        philosopherCount = table.agent_count();
+        forksCount = table.resource_count();
+        printf("Loaded topology %s, %d philosophers sharing %d forks\n", config.topology, philosopherCount, forksCount);
+    }
+    else
+    {
+        table.build_ring(philosopherCount);
+    }
+
+    // Unordered greedy is only kept as the classic deadlock demonstration on
+    // the ring, on an arbitrary graph it would just hang
+    if(config.forks == FORKS_GREEDY && config.topology != NULL)
+    {
+        printf("greedy can deadlock on a topology, use greedy-ordered\n");
+        return -1;
+    }
+
+    if(config.forks == FORKS_CHANDY_MISRA && !HygienicTable::supports(table))
+    {
+        printf("chandy-misra needs every fork shared by at most two philosophers, with capacity 1\n");
+        return -1;
+    }
+    return table.init_resources();
+}
+
+/**
+ * @brief Restricts the whole simulation to the first cpus cores of the mask it
+ * inherited (taskset, cgroup cpuset), threads created afterwards inherit the
+ * new mask. 0 keeps the inherited mask as is
+ *
+ * @return number of cpus the simulation runs on, fewer than asked if the
+ * inherited mask is smaller, -1 on failure
+ */
+int pin_to_cpus(unsigned int cpus)
+{
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed))
+    {
+        printf("Failed to read the simulation's cpu affinity\n");
+        return -1;
+    }
+    if(cpus == 0)
+    {
+        return CPU_COUNT(&allowed);
+    }
+
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    unsigned int pinned = 0;
+    for(unsigned int cpu = 0; cpu < CPU_SETSIZE && pinned < cpus; cpu++)
+    {
+        if(CPU_ISSET(cpu, &allowed))
+        {
+            CPU_SET(cpu, &mask);
+            pinned++;
+        }
+    }
+    if(sched_setaffinity(0, sizeof(mask), &mask))
+    {
+        printf("Failed to pin simulation to %u cpus\n", pinned);
+        return -1;
+    }
+    printf("Simulation pinned to %u cpus (%u requested)\n", pinned, cpus);
+    return pinned;
+}
+
 int init_sim()
 {
+    if(build_table())
+    {
+        return -1;
+    }
+
+    // From here on config.cpus is what the simulation really runs on
+    int cpus = pin_to_cpus(config.cpus);
+    if(cpus < 0)
+    {
+        return -1;
+    }
+    config.cpus = cpus;
+
 	try 
     {
-        forks = new pthread_mutex_t[forksCount];
         philosophers = new pthread_t[philosopherCount];
         threadArgs = new unsigned int[philosopherCount];
-        sched = new Scheduler(philosopherCount, &stillSitting, SCHED_UPDATE_FREQ, SCHED_SHUFFLE_TRIGGER, SCHED_ENABLE_SHUFFLE);
-        eatCounter = new unsigned int[philosopherCount];
+        sched = new Scheduler(philosopherCount, &closingTime, config.schedUpdateFreq, config.schedShuffleTrigger, config.schedWarmupMsec, SCHED_ENABLE_SHUFFLE);
+        hygienicTable = config.forks == FORKS_CHANDY_MISRA ? new HygienicTable(table, &closingTime) : NULL;
 	}
 	catch (const std::bad_alloc& e) 
     {
@@ -296,40 +677,66 @@ int init_sim()
         return -1;
 	}		
 
-    for (unsigned int mutexIndex = 0; mutexIndex < forksCount; mutexIndex++)
+    if(stats.init(philosopherCount, config.runTimeMsec))
     {
-        pthread_mutex_init(&forks[mutexIndex], NULL);
+        return -1;
     }
 
+    // One ring per philosopher plus one for the scheduler
+    if(TRACE_START(philosopherCount+1, TRACE_DEFAULT_PATH))
+    {
+        return -1;
+    }
+
+    if(pthread_barrier_init(&seatedGate, NULL, philosopherCount+1))
+    {
+        printf("Failed to set up the seating gate\n");
+        return -1;
+    }
+
+    // Philosophers barely use any stack, the default 8MB caps how many can sit
+    pthread_attr_t philosopherAttr;
+    pthread_attr_init(&philosopherAttr);
+    pthread_attr_setstacksize(&philosopherAttr, PHILOSOPHER_STACK_SIZE);
+
+    PhilosopherRoutine sit_down_on_table = select_philosopher_routine();
     for (unsigned int threadNumber = 0; threadNumber < philosopherCount; threadNumber++)
     {
         threadArgs[threadNumber] = threadNumber;
-        eatCounter[threadNumber] = 0;
-        if(pthread_create(&philosophers[threadNumber], NULL, &sit_down_on_table, (void*)(&threadArgs[threadNumber])) != 0)
+        if(pthread_create(&philosophers[threadNumber], &philosopherAttr, sit_down_on_table, (void*)(&threadArgs[threadNumber])) != 0)
         {
             printf("Failed to dispatch philosopher thread, terminating....\n");
             return -1;
         }
     }
+    pthread_attr_destroy(&philosopherAttr);
+
+    // Creating thousands of threads on a few cores takes far longer than a
+    // run, the measured window and the terminator's timer only start once the
+    // whole table is seated
+    pthread_barrier_wait(&seatedGate);
+    stats.table_opened();
     
     printf("Main is dispatching terminator thread (spooky...)\n");
 
-    unsigned int terminationTime = RUN_TIME_IN_MSEC;
+    // Terminator reads this after init_sim returns, must outlive the stack frame
+    static unsigned int terminationTime = config.runTimeMsec;
     if(pthread_create(&terminatorThread, NULL, &terminator, (void*)(&terminationTime)))
     {
         printf("Failed to dispatch terminator... terminating (ironically)....\n");
         return -1;
     }
 
-    #ifdef ENABLE_SCHED
-    printf("Main is dispatching scheduler thread\n");
-
-    if(pthread_create(&schedulerThread, NULL, &runScheduler, NULL))
+    if(config.sched == SCHED_CENTRAL)
     {
-        printf("Failed to dispatch terminator... terminating (ironically)....\n");
-        return -1;
+        printf("Main is dispatching scheduler thread\n");
+
+        if(pthread_create(&schedulerThread, NULL, &runScheduler, NULL))
+        {
+            printf("Failed to dispatch terminator... terminating (ironically)....\n");
+            return -1;
+        }
     }
-    #endif
     return 0;
 }
 
@@ -340,21 +747,69 @@ void wait_until_sim_termination()
         printf("main is waiting for thread [%d] to join\n", threadNumber);
         pthread_join(philosophers[threadNumber], NULL);
     }
+
+    if(config.sched == SCHED_CENTRAL)
+    {
+        printf("main is waiting for scheduler to join\n");
+        pthread_join(schedulerThread, NULL);
+    }
+    stats.everyone_left();
+
+    // The terminator may still be waking parked philosophers through
+    // hygienicTable, it has to be done before cleanup_sim frees it
+    pthread_join(terminatorThread, NULL);
+    pthread_barrier_destroy(&seatedGate);
+
+    TRACE_STOP();
 }
 
 void cleanup_sim()
 {
-    for (unsigned int mutexIndex = 0; mutexIndex < forksCount; mutexIndex++)
+    delete sched;
+    delete hygienicTable;
+}
+
+double timeval_to_sec(struct timeval time)
+{
+    return time.tv_sec + time.tv_usec/1e6;
+}
+
+/**
+ * @brief Appends one line describing this run to the csv at path, the header
+ * is written first if the file is empty
+ */
+void write_csv_row(const char *path, double wallSec)
+{
+    FILE *csv = fopen(path, "a");
+    if(csv == NULL)
     {
-        printf("Main destroying fork[%d]\n", mutexIndex);
-        pthread_mutex_destroy(&forks[mutexIndex]);
+        printf("Failed to open csv %s\n", path);
+        return;
     }
-    delete sched;
+    if(ftell(csv) == 0)
+    {
+        fprintf(csv, "philosophers,forks,fork_policy,sleep,sched,sched_freq_ms,shuffle_trigger,cpus,runtime_ms,"
+            "meals,eats_per_sec,fairness,starvation_p50_ms,starvation_p99_ms,starvation_max_ms,sched_p99_ms,"
+            "voluntary_ctx_switches,involuntary_ctx_switches,user_cpu_s,sys_cpu_s,wall_s,shutdown_p99_ms,shutdown_join_ms,sched_warmup_ms\n");
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    SimSummary summary = stats.summarize();
+    fprintf(csv, "%u,%u,%s,%s,%s,%u,%u,%u,%u,%lu,%.1f,%.4f,%.3f,%.3f,%.3f,%.3f,%ld,%ld,%.3f,%.3f,%.3f,%.3f,%.3f,%u\n",
+        philosopherCount, forksCount, forkPolicyNames[config.forks], sleepPolicyNames[config.sleep], schedPolicyNames[config.sched],
+        config.schedUpdateFreq, config.schedShuffleTrigger, config.cpus, config.runTimeMsec,
+        (unsigned long)summary.meals, summary.eatsPerSec, summary.fairness,
+        summary.starvationP50/1000.0, summary.starvationP99/1000.0, summary.starvationMax/1000.0, summary.schedP99/1000.0,
+        usage.ru_nvcsw, usage.ru_nivcsw, timeval_to_sec(usage.ru_utime), timeval_to_sec(usage.ru_stime), wallSec,
+        summary.shutdownP99/1000.0, summary.shutdownJoin/1000.0, config.schedWarmupMsec);
+    fclose(csv);
 }
 
 int main(int argc, char const *argv[])
 {
     printf("Simulation starting...\n");
+    uint64_t startUsec = now_usec();
 
     if(parse_args(argc, argv))
     {
@@ -371,15 +826,12 @@ int main(int argc, char const *argv[])
     cleanup_sim();
 
     printf("Simulation has concluded successfully\n");
-    printf("Metrics\n");
+    stats.report();
 
-    unsigned int total = 0;
-    for(unsigned int i = 0; i<philosopherCount; i++)
+    if(config.csvPath != NULL)
     {
-        total += eatCounter[i];
-        printf("Philosopher[%d] has eaten %u times\n", i, eatCounter[i]);
+        write_csv_row(config.csvPath, (now_usec() - startUsec)/1e6);
     }
-    printf("Total Consumptions %d\n", total);
     
     return 0;
 }
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "Trace.cpp"
+
+using std::vector;
+
+/**
+ * @brief Offline decoder for the binary trace written by the philosophers
+ * simulation. Events are drained ring by ring, so they are merged back into
+ * timestamp order before printing. Timestamps are printed relative to the
+ * first event in the file
+ *
+ * usage: ./tracedump [trace file]
+ */
+
+// Mirrors PhilosopherState in main.cpp
+const char* state_name(uint8_t state)
+{
+    switch(state)
+    {
+        case 0:
+            return "THINKING";
+        case 1:
+            return "PICKING_UP_FORKS";
+        case 2:
+            return "EATING";
+        case 3:
+            return "PUTTING_DOWN_FORKS";
+        default:
+            return "INVALID STATE!";
+    }
+}
+
+bool is_scheduler_event(uint8_t type)
+{
+    return type == TRACE_SCHED_ARBITRATE || type == TRACE_SCHED_DISPATCH || type == TRACE_SCHED_SHUFFLE || type == TRACE_SCHED_RELEASE_ALL;
+}
+
+bool by_timestamp(const TraceEvent &first, const TraceEvent &second)
+{
+    return first.timestampNs < second.timestampNs;
+}
+
+int main(int argc, char const *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : TRACE_DEFAULT_PATH;
+    FILE *in = fopen(path, "rb");
+    if(in == NULL)
+    {
+        printf("Failed to open trace file %s\n", path);
+        return -1;
+    }
+
+    TraceFileHeader header;
+    if(fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0)
+    {
+        printf("%s is not a philosophers trace\n", path);
+        fclose(in);
+        return -1;
+    }
+    if(header.version != TRACE_VERSION || header.eventSize != sizeof(TraceEvent))
+    {
+        printf("Unsupported trace version %u (event size %u)\n", header.version, header.eventSize);
+        fclose(in);
+        return -1;
+    }
+
+    vector<TraceEvent> events;
+    TraceEvent event;
+    while(fread(&event, sizeof(event), 1, in) == 1)
+    {
+        events.push_back(event);
+    }
+    fclose(in);
+
+    std::stable_sort(events.begin(), events.end(), by_timestamp);
+
+    uint64_t origin = events.empty() ? 0 : events[0].timestampNs;
+    for(long unsigned int i = 0; i < events.size(); i++)
+    {
+        const TraceEvent &e = events[i];
+        double ms = (e.timestampNs - origin)/1e6;
+        if(is_scheduler_event(e.type))
+        {
+            if(e.type == TRACE_SCHED_DISPATCH)
+            {
+                printf("%12.3fms Sched %s philosopher[%u]\n", ms, trace_event_name(e.type), e.philosopher);
+            }
+            else
+            {
+                printf("%12.3fms Sched %s\n", ms, trace_event_name(e.type));
+            }
+            continue;
+        }
+
+        printf("%12.3fms Philosopher[%u] %-18s %-14s", ms, e.philosopher, state_name(e.state), trace_event_name(e.type));
+        if(e.fork != TRACE_NO_FORK)
+        {
+            printf(" fork[%u]", e.fork);
+        }
+        if(e.type == TRACE_THINK || e.type == TRACE_EAT)
+        {
+            printf(" for %u milliseconds", e.value);
+        }
+        else if(e.type == TRACE_FORK_TRY || e.type == TRACE_FORK_ACQUIRED || e.type == TRACE_FORK_RELEASED)
+        {
+            printf(" %u forks", e.value);
+        }
+        printf("\n");
+    }
+    printf("Decoded %lu events\n", (unsigned long)events.size());
+    return 0;
+}
@@ -0,0 +1,168 @@
+#ifndef ThreadPool_CPP
+#define ThreadPool_CPP
+
+#include <atomic>
+#include <pthread.h>
+#include <stdio.h>
+#include <stddef.h>
+
+/**
+ * @brief Work handed to the pool, called once per chunk index in
+ * [0, chunkCount), from any thread and in any order
+ */
+typedef void (*ChunkRoutine)(void *args, size_t chunk);
+
+/**
+ * @brief Fixed set of pthreads started once and reused for every job, unlike
+ * pvmult in main.go which starts a goroutine per slice on every call. A job is
+ * split into chunks that workers claim one at a time from an atomic counter,
+ * so a slow or descheduled worker just claims fewer chunks. The thread calling
+ * run works through chunks too, a pool of n threads starts n-1 workers
+ */
+class ThreadPool
+{
+private:
+    pthread_t *workers;
+    unsigned int workerCount;
+    pthread_mutex_t lock;
+    pthread_cond_t workReady;
+    pthread_cond_t workDone;
+    unsigned long generation;
+    unsigned int busyWorkers;
+    bool shuttingDown;
+
+    ChunkRoutine routine;
+    void *args;
+    size_t chunkCount;
+    std::atomic<size_t> nextChunk;
+
+    static void* worker_main(void*);
+    void work_through_chunks();
+
+public:
+    ThreadPool();
+    ~ThreadPool();
+    int start(unsigned int threadCount);
+    void stop();
+    unsigned int thread_count() { return workerCount+1; }
+    void run(ChunkRoutine _routine, void *_args, size_t _chunkCount);
+};
+
+ThreadPool::ThreadPool() : workers(NULL), workerCount(0), generation(0), busyWorkers(0), shuttingDown(false),
+    routine(NULL), args(NULL), chunkCount(0), nextChunk(0)
+{
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&workReady, NULL);
+    pthread_cond_init(&workDone, NULL);
+}
+
+ThreadPool::~ThreadPool()
+{
+    stop();
+    pthread_cond_destroy(&workDone);
+    pthread_cond_destroy(&workReady);
+    pthread_mutex_destroy(&lock);
+}
+
+int ThreadPool::start(unsigned int threadCount)
+{
+    unsigned int wanted = threadCount > 1 ? threadCount-1 : 0;
+    workers = new pthread_t[wanted];
+    for(workerCount = 0; workerCount < wanted; workerCount++)
+    {
+        if(pthread_create(&workers[workerCount], NULL, &worker_main, this))
+        {
+            printf("Failed to dispatch pool worker %u\n", workerCount);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void ThreadPool::stop()
+{
+    if(workers == NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    shuttingDown = true;
+    pthread_cond_broadcast(&workReady);
+    pthread_mutex_unlock(&lock);
+
+    for(unsigned int i = 0; i < workerCount; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    delete[] workers;
+    workers = NULL;
+    workerCount = 0;
+}
+
+void ThreadPool::work_through_chunks()
+{
+    size_t chunk;
+    while((chunk = nextChunk.fetch_add(1, std::memory_order_relaxed)) < chunkCount)
+    {
+        routine(args, chunk);
+    }
+}
+
+void* ThreadPool::worker_main(void *arg)
+{
+    ThreadPool *pool = (ThreadPool*)arg;
+    unsigned long seenGeneration = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while(true)
+    {
+        while(pool->generation == seenGeneration && !pool->shuttingDown)
+        {
+            pthread_cond_wait(&pool->workReady, &pool->lock);
+        }
+        if(pool->shuttingDown)
+        {
+            break;
+        }
+        seenGeneration = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        pool->work_through_chunks();
+
+        pthread_mutex_lock(&pool->lock);
+        if(--pool->busyWorkers == 0)
+        {
+            pthread_cond_signal(&pool->workDone);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/**
+ * @brief Runs routine over every chunk and returns once all of them are done.
+ * Only one job runs at a time, run is not meant to be called concurrently
+ */
+void ThreadPool::run(ChunkRoutine _routine, void *_args, size_t _chunkCount)
+{
+    pthread_mutex_lock(&lock);
+    routine = _routine;
+    args = _args;
+    chunkCount = _chunkCount;
+    nextChunk.store(0, std::memory_order_relaxed);
+    busyWorkers = workerCount;
+    generation++;
+    pthread_cond_broadcast(&workReady);
+    pthread_mutex_unlock(&lock);
+
+    work_through_chunks();
+
+    pthread_mutex_lock(&lock);
+    while(busyWorkers > 0)
+    {
+        pthread_cond_wait(&workDone, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef VectorBuffer_CPP
+#define VectorBuffer_CPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#define CACHE_LINE 64
+#define HUGE_PAGE (2*1024*1024)
+
+enum BufferBacking {BUFFER_HUGETLB, BUFFER_TRANSPARENT_HUGE, BUFFER_ALIGNED};
+const char* bufferBackingNames[] = {"hugetlb", "transparent huge pages", "64 byte aligned"};
+
+/**
+ * @brief Memory for one vector. Big buffers come from the hugetlb pool when
+ * the machine has one reserved (vm.nr_hugepages), otherwise they are 2MB
+ * aligned and the kernel is asked to back them with transparent huge pages.
+ * Either way a 128MB array needs 64 TLB entries instead of 32768. Small
+ * buffers are just cache line aligned. Every buffer starts on at least a 64
+ * byte boundary so no vector load splits a cache line
+ */
+class VectorBuffer
+{
+private:
+    void *data;
+    size_t bytes;
+    BufferBacking backing;
+
+public:
+    VectorBuffer() : data(NULL), bytes(0), backing(BUFFER_ALIGNED) {}
+    ~VectorBuffer() { release(); }
+    int allocate(size_t _bytes);
+    void release();
+    void* get() { return data; }
+    BufferBacking backed_by() { return backing; }
+};
+
+int VectorBuffer::allocate(size_t _bytes)
+{
+    release();
+    if(_bytes >= HUGE_PAGE)
+    {
+        bytes = (_bytes + HUGE_PAGE - 1)/HUGE_PAGE*HUGE_PAGE;
+        data = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(data != MAP_FAILED)
+        {
+            backing = BUFFER_HUGETLB;
+            return 0;
+        }
+        data = aligned_alloc(HUGE_PAGE, bytes);
+        if(data != NULL && madvise(data, bytes, MADV_HUGEPAGE) == 0)
+        {
+            backing = BUFFER_TRANSPARENT_HUGE;
+            return 0;
+        }
+    }
+    else
+    {
+        bytes = (_bytes + CACHE_LINE - 1)/CACHE_LINE*CACHE_LINE;
+        data = aligned_alloc(CACHE_LINE, bytes);
+    }
+
+    backing = BUFFER_ALIGNED;
+    if(data == NULL)
+    {
+        printf("Failed to allocate a %zu byte vector\n", _bytes);
+        return -1;
+    }
+    return 0;
+}
+
+void VectorBuffer::release()
+{
+    if(data == NULL)
+    {
+        return;
+    }
+    if(backing == BUFFER_HUGETLB)
+    {
+        munmap(data, bytes);
+    }
+    else
+    {
+        free(data);
+    }
+    data = NULL;
+}
+
+#endif
@@ -0,0 +1,304 @@
+#ifndef VectorKernels_CPP
+#define VectorKernels_CPP
+
+#include <immintrin.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "ThreadPool.cpp"
+
+/**
+ * Element-wise kernels over large arrays, for 64 bit ints (Go's int in
+ * main.go) and doubles:
+ *
+ *   mul   dst = a*b
+ *   add   dst = a+b
+ *   fma   dst = a*b + c   (fused for doubles, multiply then add for ints)
+ *   adds  dst = a + value (vadds in main.go)
+ *
+ * dst may be the same array as any input. Every kernel exists as plain scalar
+ * code, AVX2 and AVX-512, all compiled into the same binary through target
+ * attributes so the build needs no -march flag, the best one the cpu supports
+ * is picked at runtime
+ */
+enum KernelIsa {ISA_SCALAR, ISA_AVX2, ISA_AVX512, ISA_COUNT};
+const char* isaNames[ISA_COUNT] = {"scalar", "avx2", "avx512"};
+
+enum KernelOp {KERNEL_MUL, KERNEL_ADD, KERNEL_FMA, KERNEL_ADDS, KERNEL_OP_COUNT};
+const char* kernelOpNames[KERNEL_OP_COUNT] = {"mul", "add", "fma", "adds"};
+// Arrays each kernel streams through (read or written), for the GB/s figure
+const unsigned int kernelOpStreams[KERNEL_OP_COUNT] = {3, 3, 4, 2};
+
+#define AVX2_TARGET __attribute__((target("avx2,fma")))
+#define AVX512_TARGET __attribute__((target("avx512f,avx512dq")))
+
+bool isa_supported(KernelIsa isa)
+{
+    __builtin_cpu_init();
+    switch(isa)
+    {
+        case ISA_AVX512:
+            return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq");
+        case ISA_AVX2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+        default:
+            return true;
+    }
+}
+
+KernelIsa best_supported_isa()
+{
+    if(isa_supported(ISA_AVX512))
+    {
+        return ISA_AVX512;
+    }
+    return isa_supported(ISA_AVX2) ? ISA_AVX2 : ISA_SCALAR;
+}
+
+/**
+ * Scalar fallback, kept out of the auto vectorizer so "scalar" really means
+ * one element per instruction when the ISAs are compared
+ */
+#define SCALAR_TARGET __attribute__((optimize("no-tree-vectorize")))
+
+template<class T>
+SCALAR_TARGET void scalar_mul(T *dst, const T *a, const T *b, const T *c, T value, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        dst[i] = a[i]*b[i];
+    }
+}
+
+template<class T>
+SCALAR_TARGET void scalar_add(T *dst, const T *a, const T *b, const T *c, T value, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        dst[i] = a[i]+b[i];
+    }
+}
+
+template<class T>
+SCALAR_TARGET void scalar_fma(T *dst, const T *a, const T *b, const T *c, T value, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        dst[i] = a[i]*b[i] + c[i];
+    }
+}
+
+template<class T>
+SCALAR_TARGET void scalar_adds(T *dst, const T *a, const T *b, const T *c, T value, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        dst[i] = a[i] + value;
+    }
+}
+
+/**
+ * Lanes of one register per ISA and element type. AVX2 has no 64 bit integer
+ * multiply, it is built from three 32x32->64 multiplies (the high*high
+ * product only lands above bit 64)
+ */
+struct Avx2Double
+{
+    typedef double Scalar;
+    typedef __m256d Vec;
+    static const size_t LANES = 4;
+    AVX2_TARGET static Vec load(const double *p) { return _mm256_loadu_pd(p); }
+    AVX2_TARGET static void store(double *p, Vec v) { _mm256_storeu_pd(p, v); }
+    AVX2_TARGET static Vec set1(double value) { return _mm256_set1_pd(value); }
+    AVX2_TARGET static Vec add(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+    AVX2_TARGET static Vec mul(Vec a, Vec b) { return _mm256_mul_pd(a, b); }
+    AVX2_TARGET static Vec fma(Vec a, Vec b, Vec c) { return _mm256_fmadd_pd(a, b, c); }
+};
+
+struct Avx2Int64
+{
+    typedef int64_t Scalar;
+    typedef __m256i Vec;
+    static const size_t LANES = 4;
+    AVX2_TARGET static Vec load(const int64_t *p) { return _mm256_loadu_si256((const __m256i*)p); }
+    AVX2_TARGET static void store(int64_t *p, Vec v) { _mm256_storeu_si256((__m256i*)p, v); }
+    AVX2_TARGET static Vec set1(int64_t value) { return _mm256_set1_epi64x(value); }
+    AVX2_TARGET static Vec add(Vec a, Vec b) { return _mm256_add_epi64(a, b); }
+    AVX2_TARGET static Vec mul(Vec a, Vec b)
+    {
+        Vec low = _mm256_mul_epu32(a, b);
+        Vec cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+        return _mm256_add_epi64(low, _mm256_slli_epi64(cross, 32));
+    }
+    AVX2_TARGET static Vec fma(Vec a, Vec b, Vec c) { return add(mul(a, b), c); }
+};
+
+struct Avx512Double
+{
+    typedef double Scalar;
+    typedef __m512d Vec;
+    static const size_t LANES = 8;
+    AVX512_TARGET static Vec load(const double *p) { return _mm512_loadu_pd(p); }
+    AVX512_TARGET static void store(double *p, Vec v) { _mm512_storeu_pd(p, v); }
+    AVX512_TARGET static Vec set1(double value) { return _mm512_set1_pd(value); }
+    AVX512_TARGET static Vec add(Vec a, Vec b) { return _mm512_add_pd(a, b); }
+    AVX512_TARGET static Vec mul(Vec a, Vec b) { return _mm512_mul_pd(a, b); }
+    AVX512_TARGET static Vec fma(Vec a, Vec b, Vec c) { return _mm512_fmadd_pd(a, b, c); }
+};
+
+struct Avx512Int64
+{
+    typedef int64_t Scalar;
+    typedef __m512i Vec;
+    static const size_t LANES = 8;
+    AVX512_TARGET static Vec load(const int64_t *p) { return _mm512_loadu_si512(p); }
+    AVX512_TARGET static void store(int64_t *p, Vec v) { _mm512_storeu_si512(p, v); }
+    AVX512_TARGET static Vec set1(int64_t value) { return _mm512_set1_epi64(value); }
+    AVX512_TARGET static Vec add(Vec a, Vec b) { return _mm512_add_epi64(a, b); }
+    AVX512_TARGET static Vec mul(Vec a, Vec b) { return _mm512_mullo_epi64(a, b); }
+    AVX512_TARGET static Vec fma(Vec a, Vec b, Vec c) { return add(mul(a, b), c); }
+};
+
+/**
+ * The same four loops for every ISA, only the target attribute differs (it
+ * can't be a template parameter). Buffers are cache line aligned, unaligned
+ * loads cost nothing on aligned data and keep any slice valid. The last
+ * n % LANES elements go through the scalar loop
+ */
+#define VECTOR_KERNEL_LOOPS(TARGET, PREFIX)                                                 \
+template<class V>                                                                           \
+TARGET void PREFIX##_mul(typename V::Scalar *dst, const typename V::Scalar *a,              \
+    const typename V::Scalar *b, const typename V::Scalar *c, typename V::Scalar value, size_t n) \
+{                                                                                           \
+    size_t i = 0;                                                                           \
+    for(; i + V::LANES <= n; i += V::LANES)                                                 \
+    {                                                                                       \
+        V::store(dst+i, V::mul(V::load(a+i), V::load(b+i)));                                \
+    }                                                                                       \
+    scalar_mul(dst+i, a+i, b+i, c, value, n-i);                                             \
+}                                                                                           \
+                                                                                            \
+template<class V>                                                                           \
+TARGET void PREFIX##_add(typename V::Scalar *dst, const typename V::Scalar *a,              \
+    const typename V::Scalar *b, const typename V::Scalar *c, typename V::Scalar value, size_t n) \
+{                                                                                           \
+    size_t i = 0;                                                                           \
+    for(; i + V::LANES <= n; i += V::LANES)                                                 \
+    {                                                                                       \
+        V::store(dst+i, V::add(V::load(a+i), V::load(b+i)));                                \
+    }                                                                                       \
+    scalar_add(dst+i, a+i, b+i, c, value, n-i);                                             \
+}                                                                                           \
+                                                                                            \
+template<class V>                                                                           \
+TARGET void PREFIX##_fma(typename V::Scalar *dst, const typename V::Scalar *a,              \
+    const typename V::Scalar *b, const typename V::Scalar *c, typename V::Scalar value, size_t n) \
+{                                                                                           \
+    size_t i = 0;                                                                           \
+    for(; i + V::LANES <= n; i += V::LANES)                                                 \
+    {                                                                                       \
+        V::store(dst+i, V::fma(V::load(a+i), V::load(b+i), V::load(c+i)));                  \
+    }                                                                                       \
+    scalar_fma(dst+i, a+i, b+i, c+i, value, n-i);                                           \
+}                                                                                           \
+                                                                                            \
+template<class V>                                                                           \
+TARGET void PREFIX##_adds(typename V::Scalar *dst, const typename V::Scalar *a,             \
+    const typename V::Scalar *b, const typename V::Scalar *c, typename V::Scalar value, size_t n) \
+{                                                                                           \
+    typename V::Vec broadcast = V::set1(value);                                             \
+    size_t i = 0;                                                                           \
+    for(; i + V::LANES <= n; i += V::LANES)                                                 \
+    {                                                                                       \
+        V::store(dst+i, V::add(V::load(a+i), broadcast));                                   \
+    }                                                                                       \
+    scalar_adds(dst+i, a+i, b, c, value, n-i);                                              \
+}
+
+VECTOR_KERNEL_LOOPS(AVX2_TARGET, avx2)
+VECTOR_KERNEL_LOOPS(AVX512_TARGET, avx512)
+
+/**
+ * @brief Every kernel shares one signature so a job can carry any of them,
+ * unused operands are ignored
+ */
+template<class T>
+struct VectorKernel
+{
+    typedef void (*Routine)(T *dst, const T *a, const T *b, const T *c, T value, size_t n);
+};
+
+template<class T, class Avx2, class Avx512>
+typename VectorKernel<T>::Routine select_kernel(KernelIsa isa, KernelOp op)
+{
+    typedef typename VectorKernel<T>::Routine Routine;
+    static const Routine table[ISA_COUNT][KERNEL_OP_COUNT] = {
+        {&scalar_mul<T>, &scalar_add<T>, &scalar_fma<T>, &scalar_adds<T>},
+        {&avx2_mul<Avx2>, &avx2_add<Avx2>, &avx2_fma<Avx2>, &avx2_adds<Avx2>},
+        {&avx512_mul<Avx512>, &avx512_add<Avx512>, &avx512_fma<Avx512>, &avx512_adds<Avx512>},
+    };
+    return table[isa][op];
+}
+
+/**
+ * @brief Kernel for op on isa, the caller checks isa_supported first
+ */
+template<class T>
+typename VectorKernel<T>::Routine kernel_for(KernelIsa isa, KernelOp op);
+
+template<>
+VectorKernel<double>::Routine kernel_for<double>(KernelIsa isa, KernelOp op)
+{
+    return select_kernel<double, Avx2Double, Avx512Double>(isa, op);
+}
+
+template<>
+VectorKernel<int64_t>::Routine kernel_for<int64_t>(KernelIsa isa, KernelOp op)
+{
+    return select_kernel<int64_t, Avx2Int64, Avx512Int64>(isa, op);
+}
+
+/**
+ * Work is cut into chunks of CHUNK_BYTES per array, small enough that the
+ * slices of all four fma operands sit in L2 together (4 x 64KB against the
+ * 256KB+ of anything with AVX2) and large enough that claiming a chunk from
+ * the pool is noise. A power of two of elements, so every chunk starts on a
+ * cache line
+ */
+#define CHUNK_BYTES (64*1024)
+
+template<class T>
+struct KernelJob
+{
+    typename VectorKernel<T>::Routine kernel;
+    T *dst;
+    const T *a;
+    const T *b;
+    const T *c;
+    T value;
+    size_t n;
+
+    static size_t chunk_elements() { return CHUNK_BYTES/sizeof(T); }
+    size_t chunk_count() const { return (n + chunk_elements() - 1)/chunk_elements(); }
+};
+
+template<class T>
+void run_kernel_chunk(void *args, size_t chunk)
+{
+    KernelJob<T> &job = *(KernelJob<T>*)args;
+    size_t low = chunk*KernelJob<T>::chunk_elements();
+    size_t count = job.n - low < KernelJob<T>::chunk_elements() ? job.n - low : KernelJob<T>::chunk_elements();
+    job.kernel(job.dst+low, job.a+low, job.b ? job.b+low : NULL, job.c ? job.c+low : NULL, job.value, count);
+}
+
+/**
+ * @brief Runs one kernel over n elements on every thread of the pool
+ */
+template<class T>
+void parallel_kernel(ThreadPool &pool, KernelIsa isa, KernelOp op, T *dst, const T *a, const T *b, const T *c, T value, size_t n)
+{
+    KernelJob<T> job = {kernel_for<T>(isa, op), dst, a, b, c, value, n};
+    pool.run(&run_kernel_chunk<T>, &job, job.chunk_count());
+}
+
+#endif
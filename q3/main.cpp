@@ -0,0 +1,366 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <chrono>
+#include "ThreadPool.cpp"
+#include "VectorBuffer.cpp"
+#include "VectorKernels.cpp"
+
+using namespace std::chrono;
+
+// The pvmult experiment in main.go
+#define PVMULT_ARRAY_SIZE 1000000
+#define PVMULT_ARRAY1_VAL 6
+#define PVMULT_ARRAY2_VAL 4
+
+#define DEFAULT_ELEMENTS (1 << 24)
+#define CHECK_ELEMENTS 100003
+#define TRIALS 5
+#define MAX_THREAD_COUNT 256
+#define MAX_ELEMENTS (1ul << 32)
+
+struct BenchConfig
+{
+    size_t elements;
+    unsigned int threads;
+    int isa;
+} config = {DEFAULT_ELEMENTS, 0, -1};
+
+ThreadPool pool;
+
+double seconds_since(high_resolution_clock::time_point start)
+{
+    return duration_cast<duration<double> >(high_resolution_clock::now() - start).count();
+}
+
+struct FillJob
+{
+    void *data;
+    size_t bytes;
+};
+
+/**
+ * @brief Zeroes (and so faults in) a buffer chunk by chunk on the pool, each
+ * page is first touched by a thread that will later stream through it
+ */
+void fill_chunk(void *args, size_t chunk)
+{
+    FillJob &job = *(FillJob*)args;
+    size_t low = chunk*CHUNK_BYTES;
+    size_t count = job.bytes - low < CHUNK_BYTES ? job.bytes - low : CHUNK_BYTES;
+    memset((char*)job.data + low, 0, count);
+}
+
+void parallel_zero(void *data, size_t bytes)
+{
+    FillJob job = {data, bytes};
+    pool.run(&fill_chunk, &job, (bytes + CHUNK_BYTES - 1)/CHUNK_BYTES);
+}
+
+struct CopyJob
+{
+    char *dst;
+    const char *src;
+    size_t bytes;
+};
+
+void copy_chunk(void *args, size_t chunk)
+{
+    CopyJob &job = *(CopyJob*)args;
+    size_t low = chunk*CHUNK_BYTES;
+    size_t count = job.bytes - low < CHUNK_BYTES ? job.bytes - low : CHUNK_BYTES;
+    memcpy(job.dst + low, job.src + low, count);
+}
+
+/**
+ * @brief STREAM style copy through the same pool and chunks, the bandwidth
+ * every kernel is measured against
+ *
+ * @return best GB/s over TRIALS runs
+ */
+double copy_bandwidth(void *dst, const void *src, size_t bytes)
+{
+    CopyJob job = {(char*)dst, (const char*)src, bytes};
+    double best = 0;
+    for(int trial = 0; trial < TRIALS; trial++)
+    {
+        auto start = high_resolution_clock::now();
+        pool.run(&copy_chunk, &job, (bytes + CHUNK_BYTES - 1)/CHUNK_BYTES);
+        double gbs = 2.0*bytes/seconds_since(start)/1e9;
+        best = gbs > best ? gbs : best;
+    }
+    return best;
+}
+
+/**
+ * @brief main.go: a = 0+6, b = 0+4, a *= b split over the pool, then every
+ * element must be 24
+ *
+ * @return number of wrong elements
+ */
+size_t run_pvmult(KernelIsa isa)
+{
+    VectorBuffer bufferA, bufferB;
+    size_t bytes = sizeof(int64_t)*PVMULT_ARRAY_SIZE;
+    if(bufferA.allocate(bytes) || bufferB.allocate(bytes))
+    {
+        return PVMULT_ARRAY_SIZE;
+    }
+    int64_t *a = (int64_t*)bufferA.get();
+    int64_t *b = (int64_t*)bufferB.get();
+    // Go's make hands out zeroed slices
+    parallel_zero(a, bytes);
+    parallel_zero(b, bytes);
+
+    auto start = high_resolution_clock::now();
+    parallel_kernel<int64_t>(pool, isa, KERNEL_ADDS, a, a, NULL, NULL, PVMULT_ARRAY1_VAL, PVMULT_ARRAY_SIZE);
+    parallel_kernel<int64_t>(pool, isa, KERNEL_ADDS, b, b, NULL, NULL, PVMULT_ARRAY2_VAL, PVMULT_ARRAY_SIZE);
+    double vaddsTime = seconds_since(start);
+
+    start = high_resolution_clock::now();
+    parallel_kernel<int64_t>(pool, isa, KERNEL_MUL, a, a, b, NULL, 0, PVMULT_ARRAY_SIZE);
+    double pvmultTime = seconds_since(start);
+    printf("DONE!\n");
+
+    size_t errors = 0;
+    for(size_t i = 0; i < PVMULT_ARRAY_SIZE; i++)
+    {
+        if(a[i] != PVMULT_ARRAY1_VAL*PVMULT_ARRAY2_VAL)
+        {
+            errors++;
+        }
+    }
+    if(errors)
+    {
+        printf("ERROR! %zu elements are not %d\n", errors, PVMULT_ARRAY1_VAL*PVMULT_ARRAY2_VAL);
+    }
+    printf("pvmult %s: vadds x2 %.3fms, pvmult %.3fms, %zu chunks of %zu elements\n", isaNames[isa], vaddsTime*1e3, pvmultTime*1e3,
+        (PVMULT_ARRAY_SIZE + KernelJob<int64_t>::chunk_elements() - 1)/KernelJob<int64_t>::chunk_elements(), KernelJob<int64_t>::chunk_elements());
+    return errors;
+}
+
+/**
+ * @brief Fills the inputs with values that make every lane different and keep
+ * int products from overflowing
+ */
+template<class T>
+void fill_inputs(T *a, T *b, T *c, size_t n)
+{
+    for(size_t i = 0; i < n; i++)
+    {
+        a[i] = (T)(i%1000) - 500;
+        b[i] = (T)(i%77) + 3;
+        c[i] = (T)(i%13);
+    }
+}
+
+/**
+ * @brief Runs every kernel of isa on an odd sized array (so the scalar tails
+ * run too) through the pool and compares against the scalar kernel
+ *
+ * @return number of kernels that disagree
+ */
+template<class T>
+unsigned int check_kernels(KernelIsa isa, const char *typeName)
+{
+    VectorBuffer buffers[5];
+    size_t bytes = sizeof(T)*CHECK_ELEMENTS;
+    for(int i = 0; i < 5; i++)
+    {
+        if(buffers[i].allocate(bytes))
+        {
+            return KERNEL_OP_COUNT;
+        }
+    }
+    T *a = (T*)buffers[0].get();
+    T *b = (T*)buffers[1].get();
+    T *c = (T*)buffers[2].get();
+    T *expected = (T*)buffers[3].get();
+    T *actual = (T*)buffers[4].get();
+    fill_inputs(a, b, c, CHECK_ELEMENTS);
+
+    unsigned int failures = 0;
+    for(int op = 0; op < KERNEL_OP_COUNT; op++)
+    {
+        kernel_for<T>(ISA_SCALAR, (KernelOp)op)(expected, a, b, c, (T)7, CHECK_ELEMENTS);
+        parallel_kernel<T>(pool, isa, (KernelOp)op, actual, a, b, c, (T)7, CHECK_ELEMENTS);
+        if(memcmp(expected, actual, bytes) != 0)
+        {
+            printf("ERROR! %s %s %s does not match scalar\n", isaNames[isa], typeName, kernelOpNames[op]);
+            failures++;
+        }
+    }
+    return failures;
+}
+
+/**
+ * @brief Best of TRIALS GB/s for every kernel of isa over config.elements,
+ * next to the copy bandwidth
+ */
+template<class T>
+void bench_kernels(KernelIsa isa, const char *typeName, T **arrays, double copyGbs)
+{
+    for(int op = 0; op < KERNEL_OP_COUNT; op++)
+    {
+        double best = 0;
+        for(int trial = 0; trial < TRIALS; trial++)
+        {
+            auto start = high_resolution_clock::now();
+            parallel_kernel<T>(pool, isa, (KernelOp)op, arrays[3], arrays[0], arrays[1], arrays[2], (T)7, config.elements);
+            double gbs = (double)kernelOpStreams[op]*sizeof(T)*config.elements/seconds_since(start)/1e9;
+            best = gbs > best ? gbs : best;
+        }
+        printf("%-7s %-7s %-5s %8.2f GB/s %6.1f%% of copy\n", isaNames[isa], typeName, kernelOpNames[op], best, 100*best/copyGbs);
+    }
+}
+
+void print_usage()
+{
+    printf("usage: ./main [elements] [threads] [scalar|avx2|avx512]\n");
+    printf("       defaults: %d elements, every online cpu, every isa the cpu supports\n", DEFAULT_ELEMENTS);
+    printf("       at most %lu elements and %d threads\n", MAX_ELEMENTS, MAX_THREAD_COUNT);
+}
+
+/**
+ * @brief Reads a number in [1, max]
+ *
+ * @return false if text is not entirely a number or out of range
+ */
+bool parse_count(const char *text, long max, long *count)
+{
+    char *end;
+    long value = strtol(text, &end, 10);
+    if(end == text || *end != '\0' || value <= 0 || value > max)
+    {
+        return false;
+    }
+    *count = value;
+    return true;
+}
+
+int parse_args(int argc, char const *argv[])
+{
+    if(argc > 4)
+    {
+        return -1;
+    }
+    long count;
+    if(argc > 1)
+    {
+        if(!parse_count(argv[1], MAX_ELEMENTS, &count))
+        {
+            return -1;
+        }
+        config.elements = count;
+    }
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    config.threads = online < 1 ? 1 : online > MAX_THREAD_COUNT ? MAX_THREAD_COUNT : online;
+    if(argc > 2)
+    {
+        if(!parse_count(argv[2], MAX_THREAD_COUNT, &count))
+        {
+            return -1;
+        }
+        config.threads = count;
+    }
+    if(argc > 3)
+    {
+        for(int isa = 0; isa < ISA_COUNT; isa++)
+        {
+            if(strcmp(argv[3], isaNames[isa]) == 0)
+            {
+                config.isa = isa;
+            }
+        }
+        if(config.isa < 0)
+        {
+            return -1;
+        }
+        if(!isa_supported((KernelIsa)config.isa))
+        {
+            printf("This cpu does not support %s\n", argv[3]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char const *argv[])
+{
+    if(parse_args(argc, argv))
+    {
+        print_usage();
+        return -1;
+    }
+    if(pool.start(config.threads))
+    {
+        return -1;
+    }
+    KernelIsa best = best_supported_isa();
+    KernelIsa first = config.isa < 0 ? ISA_SCALAR : (KernelIsa)config.isa;
+    KernelIsa last = config.isa < 0 ? best : (KernelIsa)config.isa;
+    printf("Threads %u, best isa %s, chunks of %d bytes per array\n", pool.thread_count(), isaNames[best], CHUNK_BYTES);
+
+    size_t failures = 0;
+    for(int isa = first; isa <= last; isa++)
+    {
+        if(!isa_supported((KernelIsa)isa))
+        {
+            continue;
+        }
+        failures += run_pvmult((KernelIsa)isa);
+        failures += check_kernels<int64_t>((KernelIsa)isa, "int64");
+        failures += check_kernels<double>((KernelIsa)isa, "double");
+    }
+    if(failures == 0)
+    {
+        printf("Every kernel matches the scalar reference\n");
+    }
+
+    // a, b, c and dst, all bigger than any cache by default
+    VectorBuffer buffers[4];
+    size_t bytes = sizeof(int64_t)*config.elements;
+    for(int i = 0; i < 4; i++)
+    {
+        if(buffers[i].allocate(bytes))
+        {
+            return -1;
+        }
+        parallel_zero(buffers[i].get(), bytes);
+    }
+    printf("%zu elements, %.1fMB per array, backed by %s\n", config.elements, bytes/1e6, bufferBackingNames[buffers[0].backed_by()]);
+
+    double copyGbs = copy_bandwidth(buffers[3].get(), buffers[0].get(), bytes);
+    printf("copy                  %8.2f GB/s (memory bandwidth reference)\n", copyGbs);
+
+    int64_t *ints[4];
+    double *doubles[4];
+    for(int i = 0; i < 4; i++)
+    {
+        ints[i] = (int64_t*)buffers[i].get();
+        doubles[i] = (double*)buffers[i].get();
+    }
+    fill_inputs(ints[0], ints[1], ints[2], config.elements);
+    for(int isa = first; isa <= last; isa++)
+    {
+        if(!isa_supported((KernelIsa)isa))
+        {
+            continue;
+        }
+        bench_kernels<int64_t>((KernelIsa)isa, "int64", ints, copyGbs);
+    }
+    fill_inputs(doubles[0], doubles[1], doubles[2], config.elements);
+    for(int isa = first; isa <= last; isa++)
+    {
+        if(!isa_supported((KernelIsa)isa))
+        {
+            continue;
+        }
+        bench_kernels<double>((KernelIsa)isa, "double", doubles, copyGbs);
+    }
+
+    pool.stop();
+    return failures ? -1 : 0;
+}
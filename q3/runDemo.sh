@@ -0,0 +1,2 @@
+#!/bin/bash
+for ((i=1;i<=16;i*=2)); do echo THRD_$i; ./main 16777216 $i; done